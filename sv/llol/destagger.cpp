@@ -0,0 +1,417 @@
+#include "sv/llol/destagger.h"
+
+//#define FMT_HEADER_ONLY
+#include <fmt/core.h>
+#include <glog/logging.h>
+#include <json/json.h>
+#include <tbb/parallel_for.h>
+
+#include <climits>
+#include <fstream>
+#include <numeric>
+#include <sstream>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SV_DESTAGGER_X86
+#include <immintrin.h>
+#endif
+
+#include "sv/llol/scan.h"
+#include "sv/util/math.h"
+#include "sv/util/ocv.h"
+
+namespace sv {
+
+/// Hard-coded pixel shifts of OS0-128 and OS1-64 in 1024 mode
+static const int kPixelShiftOs0128[128] = {
+    64, 43, 22, 1, 63, 42, 22, 3, 62, 42, 23, 3, 61, 42, 23, 4,
+    60, 41, 23, 5, 59, 41, 23, 6, 59, 41, 23, 6, 58, 41, 24, 7,
+    58, 41, 24, 7, 57, 40, 24, 7, 57, 40, 24, 8, 57, 40, 24, 8,
+    56, 40, 24, 8, 56, 40, 24, 8, 56, 40, 24, 8, 56, 40, 24, 8,
+    56, 40, 24, 8, 56, 40, 24, 8, 56, 40, 24, 8, 56, 40, 24, 8,
+    56, 40, 24, 8, 56, 40, 24, 7, 57, 40, 24, 7, 57, 40, 23, 7,
+    57, 40, 23, 6, 58, 40, 23, 6, 58, 41, 23, 5, 59, 41, 23, 4,
+    59, 41, 22, 4, 60, 41, 22, 3, 61, 41, 22, 2, 62, 42, 21, 0};
+static const int kPixelShiftOs164[64] = {
+    19, 12, 6, 0, 19, 13, 6, 0, 19, 13, 7, 1, 19, 13, 7, 1,
+    19, 13, 7, 1, 19, 13, 7, 1, 19, 13, 7, 1, 19, 13, 7, 1,
+    19, 13, 7, 1, 19, 13, 7, 1, 19, 13, 7, 1, 19, 13, 7, 1,
+    19, 13, 7, 1, 19, 13, 7, 1, 20, 13, 7, 1, 20, 14, 8, 1};
+
+/// LidarMeta ==================================================================
+std::string LidarMeta::Repr() const {
+  return fmt::format("LidarMeta(rows={}, cols={}, mean_shift={}, angles={})",
+                     rows,
+                     cols,
+                     MeanShift(),
+                     !altitudes.empty());
+}
+
+int LidarMeta::MeanShift() const {
+  if (pixel_shifts.empty()) return 0;
+  const double sum =
+      std::accumulate(pixel_shifts.cbegin(), pixel_shifts.cend(), 0.0);
+  return static_cast<int>(std::round(sum / pixel_shifts.size()));
+}
+
+std::vector<int> ShiftsFromAzimuths(const std::vector<float>& azimuths,
+                                    int cols) {
+  CHECK(!azimuths.empty());
+  CHECK_GT(cols, 0);
+  const auto azim_min = *std::min_element(azimuths.cbegin(), azimuths.cend());
+
+  std::vector<int> shifts;
+  shifts.reserve(azimuths.size());
+  for (const auto azim : azimuths) {
+    shifts.push_back(
+        static_cast<int>(std::round((azim - azim_min) / kTauF * cols)));
+  }
+  return shifts;
+}
+
+LidarMeta ParseLidarMeta(const std::string& json) {
+  Json::Value root;
+  std::string errs;
+  std::istringstream iss(json);
+  const Json::CharReaderBuilder builder;
+  CHECK(Json::parseFromStream(builder, iss, &root, &errs)) << errs;
+
+  LidarMeta meta;
+  for (const auto& v : root["beam_altitude_angles"]) {
+    meta.altitudes.push_back(Deg2Rad(v.asFloat()));
+  }
+  for (const auto& v : root["beam_azimuth_angles"]) {
+    meta.azimuths.push_back(Deg2Rad(v.asFloat()));
+  }
+
+  const auto& data_format = root["data_format"];
+  if (data_format.isObject()) {
+    meta.rows = data_format["pixels_per_column"].asInt();
+    meta.cols = data_format["columns_per_frame"].asInt();
+    for (const auto& v : data_format["pixel_shift_by_row"]) {
+      meta.pixel_shifts.push_back(v.asInt());
+    }
+  }
+
+  // Older firmware does not have data_format, use lidar_mode and angles
+  if (meta.rows == 0) meta.rows = static_cast<int>(meta.altitudes.size());
+  if (meta.cols == 0) {
+    const auto mode = root["lidar_mode"].asString();
+    meta.cols = std::atoi(mode.substr(0, mode.find('x')).c_str());
+  }
+  if (meta.pixel_shifts.empty() && !meta.azimuths.empty()) {
+    meta.pixel_shifts = ShiftsFromAzimuths(meta.azimuths, meta.cols);
+  }
+
+  CHECK_GT(meta.rows, 0) << "Failed to get pixels per column";
+  CHECK_GT(meta.cols, 0) << "Failed to get columns per frame";
+  CHECK_EQ(meta.pixel_shifts.size(), meta.rows) << "Bad pixel shifts";
+  return meta;
+}
+
+LidarMeta ReadLidarMeta(const std::string& file) {
+  std::ifstream ifs(file);
+  CHECK(ifs.good()) << "Failed to open " << file;
+  std::stringstream ss;
+  ss << ifs.rdbuf();
+  return ParseLidarMeta(ss.str());
+}
+
+LidarMeta MakeLegacyMeta(const cv::Size& size) {
+  CHECK(size.height == 128 || size.height == 64)
+      << "No hard-coded pixel shifts for " << size.height
+      << " beams, sensor metadata is required";
+
+  LidarMeta meta;
+  meta.rows = size.height;
+  meta.cols = size.width;
+  const int* shifts = size.height == 128 ? kPixelShiftOs0128 : kPixelShiftOs164;
+  meta.pixel_shifts.assign(shifts, shifts + size.height);
+  return meta;
+}
+
+/// Gather kernels ============================================================
+namespace {
+
+/// Raw cloud and conversion params shared by all kernels
+struct GatherArgs {
+  const uint8_t* points{};
+  int point_step{};
+  int intensity_offset{};
+  float range_scale{};
+  float max_range{};
+};
+
+/// Gather cols [c0, c1) of a row, pind and prow point to the start of the row
+void GatherRowScalar(const GatherArgs& args,
+                     const int* pind,
+                     ScanPixel* prow,
+                     int c0,
+                     int c1) {
+  for (int c = c0; c < c1; ++c) {
+    const uint8_t* const point =
+        args.points + static_cast<size_t>(args.point_step) * pind[c];
+    const auto* xyz = reinterpret_cast<const float*>(point);
+    const float rg =
+        std::sqrt(xyz[0] * xyz[0] + xyz[1] * xyz[1] + xyz[2] * xyz[2]);
+
+    auto& px = prow[c];
+    if (rg < args.max_range) {
+      px.x = xyz[0];
+      px.y = xyz[1];
+      px.z = xyz[2];
+      px.range_raw = rg * args.range_scale;
+      px.intensity = *reinterpret_cast<const uint16_t*>(
+          point + args.intensity_offset);
+    } else {
+      // Same as an empty LidarScan, nan is not Ok()
+      px = ScanPixel{kNaNF, kNaNF, kNaNF, 0, 0};
+    }
+  }
+}
+
+#ifdef SV_DESTAGGER_X86
+
+/// 4 points at a time, loads x,y,z,pad of each point then transposes
+__attribute__((target("sse4.1"))) void GatherRowSse4(const GatherArgs& args,
+                                                     const int* pind,
+                                                     ScanPixel* prow,
+                                                     int c0,
+                                                     int c1) {
+  const __m128 scale = _mm_set1_ps(args.range_scale);
+  const __m128 max_rg = _mm_set1_ps(args.max_range);
+  const __m128i mask16 = _mm_set1_epi32(0xFFFF);
+  const size_t step = args.point_step;
+
+  int c = c0;
+  for (; c + 4 <= c1; c += 4) {
+    const uint8_t* p0 = args.points + step * pind[c];
+    const uint8_t* p1 = args.points + step * pind[c + 1];
+    const uint8_t* p2 = args.points + step * pind[c + 2];
+    const uint8_t* p3 = args.points + step * pind[c + 3];
+
+    __m128 x = _mm_loadu_ps(reinterpret_cast<const float*>(p0));
+    __m128 y = _mm_loadu_ps(reinterpret_cast<const float*>(p1));
+    __m128 z = _mm_loadu_ps(reinterpret_cast<const float*>(p2));
+    __m128 w = _mm_loadu_ps(reinterpret_cast<const float*>(p3));
+    _MM_TRANSPOSE4_PS(x, y, z, w);
+
+    const __m128 rg = _mm_sqrt_ps(_mm_add_ps(
+        _mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_mul_ps(z, z)));
+    const __m128 valid = _mm_cmplt_ps(rg, max_rg);
+
+    const int o = args.intensity_offset;
+    const __m128i intensity =
+        _mm_set_epi32(*reinterpret_cast<const uint16_t*>(p3 + o),
+                      *reinterpret_cast<const uint16_t*>(p2 + o),
+                      *reinterpret_cast<const uint16_t*>(p1 + o),
+                      *reinterpret_cast<const uint16_t*>(p0 + o));
+    const __m128i range_raw = _mm_cvttps_epi32(_mm_mul_ps(rg, scale));
+    // Low 16 bits are range_raw and high 16 bits are intensity
+    const __m128i ri = _mm_or_si128(_mm_and_si128(range_raw, mask16),
+                                    _mm_slli_epi32(intensity, 16));
+
+    // Invalid points get nan xyz, zero range and intensity
+    const __m128 nan = _mm_set1_ps(kNaNF);
+    x = _mm_blendv_ps(nan, x, valid);
+    y = _mm_blendv_ps(nan, y, valid);
+    z = _mm_blendv_ps(nan, z, valid);
+    w = _mm_and_ps(_mm_castsi128_ps(ri), valid);
+    _MM_TRANSPOSE4_PS(x, y, z, w);
+
+    auto* out = reinterpret_cast<float*>(prow + c);
+    _mm_storeu_ps(out, x);
+    _mm_storeu_ps(out + 4, y);
+    _mm_storeu_ps(out + 8, z);
+    _mm_storeu_ps(out + 12, w);
+  }
+
+  GatherRowScalar(args, pind, prow, c, c1);
+}
+
+/// 8 points at a time, gathers x,y,z and intensity then transposes
+__attribute__((target("avx2"))) void GatherRowAvx2(const GatherArgs& args,
+                                                   const int* pind,
+                                                   ScanPixel* prow,
+                                                   int c0,
+                                                   int c1) {
+  const __m256i step = _mm256_set1_epi32(args.point_step);
+  const __m256 scale = _mm256_set1_ps(args.range_scale);
+  const __m256 max_rg = _mm256_set1_ps(args.max_range);
+  const __m256i mask16 = _mm256_set1_epi32(0xFFFF);
+  const auto* xyz = reinterpret_cast<const float*>(args.points);
+  const auto* its =
+      reinterpret_cast<const int*>(args.points + args.intensity_offset);
+
+  int c = c0;
+  for (; c + 8 <= c1; c += 8) {
+    // Byte offset of each point
+    const __m256i inds =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pind + c));
+    const __m256i offsets = _mm256_mullo_epi32(inds, step);
+
+    const __m256 x = _mm256_i32gather_ps(xyz, offsets, 1);
+    const __m256 y = _mm256_i32gather_ps(xyz + 1, offsets, 1);
+    const __m256 z = _mm256_i32gather_ps(xyz + 2, offsets, 1);
+    const __m256i intensity = _mm256_i32gather_epi32(its, offsets, 1);
+
+    const __m256 rg = _mm256_sqrt_ps(
+        _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, x), _mm256_mul_ps(y, y)),
+                      _mm256_mul_ps(z, z)));
+    const __m256 valid = _mm256_cmp_ps(rg, max_rg, _CMP_LT_OQ);
+
+    const __m256i range_raw = _mm256_cvttps_epi32(_mm256_mul_ps(rg, scale));
+    // Low 16 bits are range_raw and high 16 bits are intensity
+    const __m256i ri = _mm256_or_si256(_mm256_and_si256(range_raw, mask16),
+                                       _mm256_slli_epi32(intensity, 16));
+
+    // Invalid points get nan xyz, zero range and intensity
+    const __m256 nan = _mm256_set1_ps(kNaNF);
+    const __m256 xv = _mm256_blendv_ps(nan, x, valid);
+    const __m256 yv = _mm256_blendv_ps(nan, y, valid);
+    const __m256 zv = _mm256_blendv_ps(nan, z, valid);
+    const __m256 wv = _mm256_and_ps(_mm256_castsi256_ps(ri), valid);
+
+    // Transpose 4x8 into 8 pixels, lane 0 has pixel 0-3, lane 1 has 4-7
+    const __m256 t0 = _mm256_unpacklo_ps(xv, yv);  // x0 y0 x1 y1
+    const __m256 t1 = _mm256_unpackhi_ps(xv, yv);  // x2 y2 x3 y3
+    const __m256 t2 = _mm256_unpacklo_ps(zv, wv);  // z0 w0 z1 w1
+    const __m256 t3 = _mm256_unpackhi_ps(zv, wv);  // z2 w2 z3 w3
+    const __m256 q0 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0));
+    const __m256 q1 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2));
+    const __m256 q2 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0));
+    const __m256 q3 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3, 2, 3, 2));
+
+    auto* out = reinterpret_cast<float*>(prow + c);
+    _mm256_storeu_ps(out, _mm256_permute2f128_ps(q0, q1, 0x20));
+    _mm256_storeu_ps(out + 8, _mm256_permute2f128_ps(q2, q3, 0x20));
+    _mm256_storeu_ps(out + 16, _mm256_permute2f128_ps(q0, q1, 0x31));
+    _mm256_storeu_ps(out + 24, _mm256_permute2f128_ps(q2, q3, 0x31));
+  }
+
+  GatherRowScalar(args, pind, prow, c, c1);
+}
+
+#endif
+
+using GatherRowFunc = void (*)(
+    const GatherArgs&, const int*, ScanPixel*, int, int);
+
+GatherRowFunc SelectGatherRow(Isa isa) {
+#ifdef SV_DESTAGGER_X86
+  switch (isa) {
+    case Isa::kAvx2:
+      return GatherRowAvx2;
+    case Isa::kSse4:
+      return GatherRowSse4;
+    default:
+      break;
+  }
+#endif
+  return GatherRowScalar;
+}
+
+/// Tile size for column major cloud
+constexpr int kTileRows = 16;
+constexpr int kTileCols = 32;
+
+}  // namespace
+
+/// Destagger ==================================================================
+Destagger::Destagger(const LidarMeta& meta, const DestaggerParams& params)
+    : row_major{params.row_major},
+      col_offset{params.col_offset < 0 ? meta.MeanShift() : params.col_offset},
+      range_scale{params.range_scale},
+      max_range{params.max_range},
+      isa{BestIsa()},
+      inds{meta.size(), CV_32SC1} {
+  CHECK_GT(meta.rows, 0);
+  CHECK_GT(meta.cols, 0);
+  CHECK_EQ(meta.pixel_shifts.size(), meta.rows);
+  CHECK_GT(range_scale, 0);
+
+  const int rows = meta.rows;
+  const int cols = meta.cols;
+
+  // Pixel (r, c) of the scan is point (r, c - shift + offset) in the cloud
+  for (int r = 0; r < rows; ++r) {
+    const int shift = col_offset - meta.pixel_shifts[r];
+    auto* prow = inds.ptr<int>(r);
+    for (int c = 0; c < cols; ++c) {
+      const int src_c = ((c + shift) % cols + cols) % cols;
+      prow[c] = row_major ? r * cols + src_c : src_c * rows + r;
+    }
+  }
+}
+
+std::string Destagger::Repr() const {
+  return fmt::format(
+      "Destagger(row_major={}, col_offset={}, range_scale={}, max_range={}, "
+      "isa={}, inds={})",
+      row_major,
+      col_offset,
+      range_scale,
+      max_range,
+      static_cast<int>(isa),
+      sv::Repr(inds));
+}
+
+void Destagger::Gather(const uint8_t* points,
+                       int point_step,
+                       int intensity_offset,
+                       cv::Mat& scan,
+                       int gsize) const {
+  Gather(points, point_step, intensity_offset, {0, cols()}, scan, gsize);
+}
+
+void Destagger::Gather(const uint8_t* points,
+                       int point_step,
+                       int intensity_offset,
+                       const cv::Range& curr,
+                       cv::Mat& scan,
+                       int gsize) const {
+  CHECK(points != nullptr);
+  CHECK_EQ(scan.type(), LidarScan::kDtype);
+  CHECK_EQ(scan.rows, rows());
+  CHECK_EQ(scan.cols, curr.size());
+  CHECK_GE(curr.start, 0);
+  CHECK_LE(curr.end, cols());
+
+  const GatherArgs args{
+      points, point_step, intensity_offset, range_scale, max_range};
+
+  // Simd kernels read 16 bytes at the start of a point, 4 bytes at intensity
+  // and use int32 byte offsets
+  auto kernel_isa = std::min(isa, BestIsa());
+  if (point_step < 16 || intensity_offset + 4 > point_step ||
+      static_cast<int64_t>(inds.total()) * point_step > INT_MAX) {
+    kernel_isa = Isa::kScalar;
+  }
+  const auto gather_row = SelectGatherRow(kernel_isa);
+
+  // Row major cloud reads along each row, column major cloud reads along each
+  // column, hence we gather a small tile of rows each time
+  const int width = curr.size();
+  const int tile_rows = row_major ? 1 : kTileRows;
+  const int tile_cols = row_major ? width : kTileCols;
+  gsize = gsize <= 0 ? rows() : gsize;
+
+  tbb::parallel_for(
+      tbb::blocked_range<int>(0, rows(), gsize), [&](const auto& blk) {
+        for (int r0 = blk.begin(); r0 < blk.end(); r0 += tile_rows) {
+          const int r1 = std::min(r0 + tile_rows, blk.end());
+          for (int c0 = 0; c0 < width; c0 += tile_cols) {
+            const int c1 = std::min(c0 + tile_cols, width);
+            for (int r = r0; r < r1; ++r) {
+              gather_row(args,
+                         inds.ptr<int>(r) + curr.start,
+                         scan.ptr<ScanPixel>(r),
+                         c0,
+                         c1);
+            }
+          }
+        }
+      });
+}
+
+}  // namespace sv
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <opencv2/core/mat.hpp>
+
+#include "sv/llol/scan.h"  // Isa
+
+namespace sv {
+
+/// @struct Lidar metadata needed for destaggering, see ouster sensor json
+struct LidarMeta {
+  int rows{};                     // pixels per column
+  int cols{};                     // columns per frame
+  std::vector<int> pixel_shifts;  // pixel shift of each row
+  std::vector<float> altitudes;   // beam altitude angles [rad]
+  std::vector<float> azimuths;    // beam azimuth angles [rad]
+
+  std::string Repr() const;
+  friend std::ostream& operator<<(std::ostream& os, const LidarMeta& rhs) {
+    return os << rhs.Repr();
+  }
+
+  bool empty() const noexcept { return pixel_shifts.empty(); }
+  cv::Size size() const noexcept { return {cols, rows}; }
+  /// @brief Mean pixel shift, which centers the firing time of a column
+  int MeanShift() const;
+};
+
+/// @brief Parse ouster metadata from a json string / file
+LidarMeta ParseLidarMeta(const std::string& json);
+LidarMeta ReadLidarMeta(const std::string& file);
+
+/// @brief Pixel shift of each row computed from beam azimuths, used when
+/// metadata does not contain pixel_shift_by_row
+std::vector<int> ShiftsFromAzimuths(const std::vector<float>& azimuths,
+                                    int cols);
+
+/// @brief Metadata with hard-coded shifts of OS0-128 and OS1-64, for when no
+/// sensor metadata is available
+LidarMeta MakeLegacyMeta(const cv::Size& size);
+
+struct DestaggerParams {
+  bool row_major{true};       // whether the incoming cloud is row major
+  int col_offset{-1};         // extra column offset, < 0 means mean shift
+  float range_scale{512.0F};  // scale of range_raw
+  float max_range{127.0F};    // points beyond this are zeroed
+};
+
+/// @struct Destagger is a precomputed flat gather table, which maps each
+/// pixel of the destaggered scan to the index of a point in the raw cloud
+struct Destagger {
+  bool row_major{true};
+  int col_offset{};
+  float range_scale{};
+  float max_range{};
+  Isa isa{Isa::kScalar};  // gather kernel, capped by BestIsa()
+  cv::Mat inds;           // CV_32SC1, index of cloud point of each pixel
+
+  Destagger() = default;
+  explicit Destagger(const LidarMeta& meta, const DestaggerParams& params = {});
+
+  std::string Repr() const;
+  friend std::ostream& operator<<(std::ostream& os, const Destagger& rhs) {
+    return os << rhs.Repr();
+  }
+
+  int rows() const noexcept { return inds.rows; }
+  int cols() const noexcept { return inds.cols; }
+  cv::Size size() const noexcept { return {inds.cols, inds.rows}; }
+  int IndexAt(int r, int c) const { return inds.at<int>(r, c); }
+
+  /// @brief Gather points of a raw cloud into scan (32FC4, ScanPixel)
+  /// @details Column major cloud is processed in tiles so that reads of
+  /// neighboring columns stay in cache
+  /// @param points is raw cloud data with xyz float at the start of a point
+  /// @param point_step is number of bytes of each point
+  /// @param intensity_offset is byte offset of a uint16 intensity field
+  void Gather(const uint8_t* points,
+              int point_step,
+              int intensity_offset,
+              cv::Mat& scan,
+              int gsize = 0) const;
+  /// @brief Only gather columns in curr, scan has curr.size() columns
+  void Gather(const uint8_t* points,
+              int point_step,
+              int intensity_offset,
+              const cv::Range& curr,
+              cv::Mat& scan,
+              int gsize = 0) const;
+};
+
+}  // namespace sv
@@ -0,0 +1,254 @@
+#include "sv/llol/destagger.h"
+
+#include <benchmark/benchmark.h>
+#include <gtest/gtest.h>
+
+#include "sv/llol/scan.h"
+
+namespace sv {
+namespace {
+
+/// Equal or both nan
+bool SameFloat(float a, float b) {
+  return a == b || (std::isnan(a) && std::isnan(b));
+}
+
+/// Point layout of ouster cloud
+struct OusterPoint {
+  float x{};
+  float y{};
+  float z{};
+  float pad{};
+  float intensity{};
+  uint32_t t{};
+  uint16_t reflectivity{};
+  uint8_t ring{};
+  uint16_t ambient{};
+  uint32_t range{};
+};
+
+std::vector<OusterPoint> MakeTestCloud(const cv::Size& size) {
+  std::vector<OusterPoint> cloud(size.area());
+  for (int i = 0; i < size.area(); ++i) {
+    auto& p = cloud[i];
+    p.x = 1.0F + i % 7;
+    p.y = 0.5F;
+    p.z = 0.25F;
+    p.reflectivity = i % 1000;
+  }
+  return cloud;
+}
+
+TEST(LidarMetaTest, TestLegacy) {
+  const auto meta = MakeLegacyMeta({1024, 128});
+  std::cout << meta << "\n";
+  EXPECT_EQ(meta.rows, 128);
+  EXPECT_EQ(meta.cols, 1024);
+  EXPECT_EQ(meta.pixel_shifts.size(), 128);
+  EXPECT_EQ(meta.MeanShift(), 32);
+}
+
+TEST(LidarMetaTest, TestParse) {
+  const std::string json = R"({
+    "beam_altitude_angles": [2.0, 1.0, -1.0, -2.0],
+    "beam_azimuth_angles": [4.2, 1.4, -1.4, -4.2],
+    "data_format": {
+      "pixels_per_column": 4,
+      "columns_per_frame": 512,
+      "pixel_shift_by_row": [12, 8, 4, 0]
+    },
+    "lidar_mode": "512x10"
+  })";
+
+  const auto meta = ParseLidarMeta(json);
+  std::cout << meta << "\n";
+  EXPECT_EQ(meta.rows, 4);
+  EXPECT_EQ(meta.cols, 512);
+  EXPECT_EQ(meta.pixel_shifts, std::vector<int>({12, 8, 4, 0}));
+  EXPECT_EQ(meta.altitudes.size(), 4);
+  EXPECT_FLOAT_EQ(meta.altitudes[0], Deg2Rad(2.0F));
+  EXPECT_EQ(meta.MeanShift(), 6);
+}
+
+TEST(LidarMetaTest, TestParseNoDataFormat) {
+  const std::string json = R"({
+    "beam_altitude_angles": [2.0, 1.0, -1.0, -2.0],
+    "beam_azimuth_angles": [4.2, 1.4, -1.4, -4.2],
+    "lidar_mode": "1024x10"
+  })";
+
+  const auto meta = ParseLidarMeta(json);
+  EXPECT_EQ(meta.rows, 4);
+  EXPECT_EQ(meta.cols, 1024);
+  EXPECT_EQ(meta.pixel_shifts, ShiftsFromAzimuths(meta.azimuths, 1024));
+  EXPECT_EQ(meta.pixel_shifts.back(), 0);
+  EXPECT_EQ(meta.pixel_shifts.front(), 24);
+}
+
+TEST(DestaggerTest, TestTable) {
+  const auto meta = MakeLegacyMeta({1024, 64});
+  const int rows = meta.rows;
+  const int cols = meta.cols;
+
+  for (const bool row_major : {true, false}) {
+    DestaggerParams dp;
+    dp.row_major = row_major;
+    dp.col_offset = 15;
+    const Destagger ds(meta, dp);
+    std::cout << ds << "\n";
+
+    for (int r = 0; r < rows; ++r) {
+      for (int c = 0; c < cols; ++c) {
+        const int src_c = (c + cols - meta.pixel_shifts[r] + 15) % cols;
+        const int i = row_major ? r * cols + src_c : src_c * rows + r;
+        ASSERT_EQ(ds.IndexAt(r, c), i);
+      }
+    }
+  }
+}
+
+TEST(DestaggerTest, TestGather) {
+  const auto meta = MakeLegacyMeta({1024, 64});
+  const auto cloud = MakeTestCloud(meta.size());
+  const auto* points = reinterpret_cast<const uint8_t*>(cloud.data());
+
+  DestaggerParams dp;
+  dp.max_range = 6.0F;
+  const Destagger ds(meta, dp);
+
+  cv::Mat scan(meta.size(), LidarScan::kDtype);
+  ds.Gather(points,
+            sizeof(OusterPoint),
+            offsetof(OusterPoint, reflectivity),
+            scan);
+
+  for (int r = 0; r < scan.rows; ++r) {
+    for (int c = 0; c < scan.cols; ++c) {
+      const auto& p = cloud[ds.IndexAt(r, c)];
+      const auto& px = scan.at<ScanPixel>(r, c);
+      const float rg = std::sqrt(p.x * p.x + p.y * p.y + p.z * p.z);
+      if (rg < dp.max_range) {
+        ASSERT_EQ(px.x, p.x);
+        ASSERT_EQ(px.range_raw, static_cast<uint16_t>(rg * dp.range_scale));
+        ASSERT_EQ(px.intensity, p.reflectivity);
+      } else {
+        ASSERT_FALSE(px.Ok());
+        ASSERT_TRUE(std::isnan(px.y) && std::isnan(px.z));
+        ASSERT_EQ(px.range_raw, 0);
+        ASSERT_EQ(px.intensity, 0);
+      }
+    }
+  }
+}
+
+TEST(DestaggerTest, TestGatherIsa) {
+  // Odd number of cols to test remainder
+  const auto meta = MakeLegacyMeta({1001, 64});
+  auto cloud = MakeTestCloud(meta.size());
+  cloud[10].x = -200.0F;
+  cloud[11].x = kNaNF;
+  const auto* points = reinterpret_cast<const uint8_t*>(cloud.data());
+  std::cout << "best isa: " << static_cast<int>(BestIsa()) << "\n";
+
+  for (const bool row_major : {true, false}) {
+    DestaggerParams dp;
+    dp.row_major = row_major;
+    dp.max_range = 6.0F;
+    Destagger ds(meta, dp);
+
+    ds.isa = Isa::kScalar;
+    cv::Mat scan0(meta.size(), LidarScan::kDtype);
+    ds.Gather(points,
+              sizeof(OusterPoint),
+              offsetof(OusterPoint, reflectivity),
+              scan0);
+
+    for (const auto isa : {Isa::kSse4, Isa::kAvx2}) {
+      ds.isa = isa;
+      cv::Mat scan1(meta.size(), LidarScan::kDtype);
+      ds.Gather(points,
+                sizeof(OusterPoint),
+                offsetof(OusterPoint, reflectivity),
+                scan1,
+                8);
+
+      for (int r = 0; r < scan0.rows; ++r) {
+        for (int c = 0; c < scan0.cols; ++c) {
+          const auto& px0 = scan0.at<ScanPixel>(r, c);
+          const auto& px1 = scan1.at<ScanPixel>(r, c);
+          ASSERT_TRUE(SameFloat(px0.x, px1.x));
+          ASSERT_TRUE(SameFloat(px0.y, px1.y));
+          ASSERT_TRUE(SameFloat(px0.z, px1.z));
+          ASSERT_EQ(px0.range_raw, px1.range_raw);
+          ASSERT_EQ(px0.intensity, px1.intensity);
+        }
+      }
+    }
+  }
+}
+
+TEST(DestaggerTest, TestGatherRange) {
+  const auto meta = MakeLegacyMeta({1024, 64});
+  const auto cloud = MakeTestCloud(meta.size());
+  const auto* points = reinterpret_cast<const uint8_t*>(cloud.data());
+
+  DestaggerParams dp;
+  dp.row_major = false;
+  const Destagger ds(meta, dp);
+
+  cv::Mat scan0(meta.size(), LidarScan::kDtype);
+  ds.Gather(points,
+            sizeof(OusterPoint),
+            offsetof(OusterPoint, reflectivity),
+            scan0);
+
+  // Gather in 4 chunks should give the same scan
+  cv::Mat scan1(meta.size(), LidarScan::kDtype);
+  for (int c0 = 0; c0 < scan1.cols; c0 += 256) {
+    const cv::Range curr{c0, c0 + 256};
+    cv::Mat chunk = scan1.colRange(curr);
+    ds.Gather(points,
+              sizeof(OusterPoint),
+              offsetof(OusterPoint, reflectivity),
+              curr,
+              chunk);
+  }
+
+  for (int r = 0; r < scan0.rows; ++r) {
+    for (int c = 0; c < scan0.cols; ++c) {
+      const auto& px0 = scan0.at<ScanPixel>(r, c);
+      const auto& px1 = scan1.at<ScanPixel>(r, c);
+      ASSERT_TRUE(SameFloat(px0.x, px1.x));
+      ASSERT_EQ(px0.range_raw, px1.range_raw);
+      ASSERT_EQ(px0.intensity, px1.intensity);
+    }
+  }
+}
+
+void BM_DestaggerGather(benchmark::State& state) {
+  const auto meta = MakeLegacyMeta({2048, 128});
+  const auto cloud = MakeTestCloud(meta.size());
+  const auto* points = reinterpret_cast<const uint8_t*>(cloud.data());
+
+  DestaggerParams dp;
+  dp.row_major = state.range(0);
+  Destagger ds(meta, dp);
+  ds.isa = static_cast<Isa>(state.range(1));
+  cv::Mat scan(meta.size(), LidarScan::kDtype);
+
+  for (auto _ : state) {
+    ds.Gather(points,
+              sizeof(OusterPoint),
+              offsetof(OusterPoint, reflectivity),
+              scan);
+    benchmark::DoNotOptimize(scan);
+  }
+}
+BENCHMARK(BM_DestaggerGather)
+    ->ArgsProduct({{0, 1},
+                   {static_cast<int>(Isa::kScalar),
+                    static_cast<int>(Isa::kSse4),
+                    static_cast<int>(Isa::kAvx2)}});
+
+}  // namespace
+}  // namespace sv
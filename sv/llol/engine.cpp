@@ -0,0 +1,364 @@
+#include "sv/llol/engine.h"
+
+#include <glog/logging.h>
+#include <tbb/flow_graph.h>
+
+namespace sv {
+
+void OdomEngine::InitLidar(const cv::Size& sweep_size,
+                           const GridParams& grid_params,
+                           const TrajectoryParams& traj_params,
+                           const GicpParams& gicp_params) {
+  sweep = LidarSweep{sweep_size};
+  grid = SweepGrid{sweep.size(), grid_params};
+  traj = Trajectory{grid.cols() + 1, traj_params};
+  gicp = GicpSolver{gicp_params};
+}
+
+bool OdomEngine::InitExtrinsics(const Sophus::SE3d& T_imu_lidar) {
+  CHECK(lidar_init()) << "Lidar must be initialized before extrinsics";
+  if (!imuq.full()) return false;
+
+  const auto& imu = imuq.buf.back();
+  const auto imu_mean = imuq.CalcMean(10);
+  LOG(INFO) << "acc_curr: " << imu.acc.transpose()
+            << ", norm: " << imu.acc.norm();
+  LOG(INFO) << "acc_mean: " << imu_mean.acc.transpose()
+            << ", norm: " << imu_mean.acc.norm();
+
+  // Use the one that is closer to gravity norm
+  const auto curr_acc_norm = imu.acc.norm();
+  const auto mean_acc_norm = imu_mean.acc.norm();
+  const auto gnorm = traj.gravity_norm;
+
+  if (gnorm > 0 &&
+      std::abs(curr_acc_norm - gnorm) < std::abs(mean_acc_norm - gnorm)) {
+    LOG(INFO) << "Use curr acc as gravity";
+    traj.Init(T_imu_lidar, imu.acc);
+  } else {
+    LOG(INFO) << "Use mean acc as gravity";
+    traj.Init(T_imu_lidar, imu_mean.acc);
+  }
+
+  tf_init_ = true;
+  return true;
+}
+
+void OdomEngine::PrepareScan(const cv::Range& curr) {
+  total_timer_.Start();
+  EjectScan(curr);
+}
+
+void OdomEngine::AddScan(const LidarScan& scan) {
+  // Imus received meanwhile are used for prediction of this scan
+  SyncImus();
+  CHECK(Ready()) << "Engine is not ready";
+
+  // A scan written in place via PrepareScan() is already ejected
+  const bool eject = scan.mat.data != sweep.mat.colRange(scan.curr).data;
+  if (eject) total_timer_.Start();
+  Preprocess(scan, eject);
+
+  OdomOutput output;
+  output.icp_ok = Register();
+  output.T_odom_pano_prev = PostProcess();
+  output.rendered = output.T_odom_pano_prev.has_value();
+  UpdateTotal();
+
+  if (!output_cb) return;
+  output.time = scan.time;
+  output.T_odom_lidar = traj.TfOdomLidar();
+  output.T_odom_pano = traj.T_odom_pano;
+  output_cb(output);
+}
+
+void OdomEngine::EjectScan(const cv::Range& curr) {
+  const int n_added = AddToPano(curr);
+  sm.GetRef("pano.add_points").Add(n_added);
+}
+
+void OdomEngine::Preprocess(const LidarScan& scan, bool eject) {
+  int n_added = 0;
+  int n_points = 0;
+  cv::Vec2i n_cells{};
+  int n_imus = 0;
+
+  Timer timer;
+  if (gsize <= 0) {
+    if (eject) n_added = AddToPano(scan.curr);
+    n_points = AddToSweep(scan);
+    n_cells = AddToGrid(scan);
+    n_imus = PredictTraj();
+  } else {
+    // Pano only reads columns of sweep that are about to be overwritten, and
+    // grid only reads the scan, so the two chains could run concurrently
+    namespace flow = tbb::flow;
+    using Node = flow::continue_node<flow::continue_msg>;
+    flow::graph graph;
+    flow::broadcast_node<flow::continue_msg> start(graph);
+    Node pano_add(graph, [&](const auto&) {
+      if (eject) n_added = AddToPano(scan.curr);
+    });
+    Node sweep_add(graph, [&](const auto&) { n_points = AddToSweep(scan); });
+    Node grid_add(graph, [&](const auto&) { n_cells = AddToGrid(scan); });
+    Node imu_integrate(graph, [&](const auto&) { n_imus = PredictTraj(); });
+
+    flow::make_edge(start, pano_add);
+    flow::make_edge(pano_add, sweep_add);
+    flow::make_edge(start, grid_add);
+    flow::make_edge(grid_add, imu_integrate);
+    start.try_put(flow::continue_msg{});
+    graph.wait_for_all();
+  }
+  timer.Stop();
+
+  // Critical path is the longer of the two chains, compare with wall time to
+  // see overhead of the graph
+  const auto LastTime = [this](const char* name) {
+    return tm.GetStats(name).last();
+  };
+  const auto t_pano = eject ? LastTime("1.Pano.Add") : absl::ZeroDuration();
+  const auto t_chain1 = t_pano + LastTime("2.Sweep.Add");
+  const auto t_chain2 = LastTime("3.Grid.Add") + LastTime("4.Imu.Integrate");
+  TimerManager::StatsT t_wall;
+  TimerManager::StatsT t_path;
+  t_wall.Add(absl::Nanoseconds(timer.Elapsed()));
+  t_path.Add(std::max(t_chain1, t_chain2));
+  tm.Update("Preprocess", t_wall);
+  tm.Update("Preprocess.Path", t_path);
+  VLOG(1) << "[Preprocess] wall: " << t_wall.last()
+          << ", pano+sweep: " << t_chain1 << ", grid+imu: " << t_chain2;
+
+  if (eject) sm.GetRef("pano.add_points").Add(n_added);
+  sm.GetRef("sweep.add").Add(n_points);
+  sm.GetRef("grid.valid_cells").Add(n_cells[0]);
+  sm.GetRef("grid.good_cells").Add(n_cells[1]);
+  sm.GetRef("traj.pred_imus").Add(n_imus);
+}
+
+int OdomEngine::AddToPano(const cv::Range& curr) {
+  // 1. Eject scan to pano, assuming traj is optimized
+  int n_added = 0;
+  {  // Note that at this point the new scan is not yet added to the sweep
+    auto _ = tm.Scoped("1.Pano.Add");
+    // Only poses of the ejected columns are needed
+    sweep.InterpRange(curr, gsize);
+    n_added = pano.Add(sweep, curr, gsize);
+  }
+  VLOG(1) << "[pano.Add] num added: " << n_added;
+  return n_added;
+}
+
+int OdomEngine::AddToSweep(const LidarScan& scan) {
+  // 2. Add current scan to sweep
+  int n_points = 0;
+  {  // Add scan to sweep
+    auto _ = tm.Scoped("2.Sweep.Add");
+    n_points = sweep.Add(scan);
+  }
+  VLOG(1) << "[sweep.Add] num added: " << n_points;
+  return n_points;
+}
+
+cv::Vec2i OdomEngine::AddToGrid(const LidarScan& scan) {
+  // 3. Add current scan to grid
+  cv::Vec2i n_cells{};
+  {  // Reduce scan to grid and Filter
+    auto _ = tm.Scoped("3.Grid.Add");
+    n_cells = grid.Add(scan, gsize);
+  }
+  VLOG(1) << "[grid.Add] Num valid cells: " << n_cells[0]
+          << ", num good cells: " << n_cells[1];
+  return n_cells;
+}
+
+int OdomEngine::PredictTraj() {
+  // 4. Predict new scetion in trajectory, needs grid time of current scan
+  int n_imus{};
+  {  // Integarte imu to fill nominal traj
+    auto _ = tm.Scoped("4.Imu.Integrate");
+    const int pred_cols = grid.curr.size();
+    const auto t0 = grid.TimeAt(grid.cols() - pred_cols);
+    const auto dt = grid.dt;
+
+    // Predict the segment of traj corresponding to current grid
+    n_imus = traj.PredictNew(imuq, t0, dt, pred_cols);
+  }
+  VLOG(1) << "[traj.Predict] num imus: " << n_imus;
+  return n_imus;
+}
+
+bool OdomEngine::Register() {
+  bool icp_ok = false;
+
+  // 2 is because the first sweep added to pano is junk, so we need to wait for
+  // the second sweep to be added
+  if (pano.ready()) {
+    icp_ok = IcpRigid();
+  } else {
+    LOG(WARNING) << "Pano is not ready, num sweeps: " << pano.num_sweeps;
+  }
+
+  VLOG(1) << "velocity: " << traj.back().vel.transpose()
+          << ", norm: " << traj.back().vel.norm();
+
+  // Do not update bias if icp was not running
+  if (icp_ok && traj.update_bias) {
+    traj.UpdateBias(imuq);
+    VLOG(1) << "gyr_bias: " << imuq.bias.gyr.transpose();
+    VLOG(1) << "acc_bias: " << imuq.bias.acc.transpose();
+  }
+
+  return icp_ok;
+}
+
+bool OdomEngine::IcpRigid() {
+  auto t_match = tm.Manual("5.Grid.Match", false);
+  auto t_solve = tm.Manual("6.Icp.Solve", false);
+
+  if (!cost_) cost_.emplace(gicp.imu_weight, gsize);
+  auto& cost = *cost_;
+  cost.UpdatePreint(traj, imuq);
+  VLOG(1) << "[cost.Preint] num imus: " << cost.preint.n;
+
+  auto& opts = solver_.options;
+  opts.max_num_iterations = gicp.inner_iters;
+  opts.gradient_tolerance = 1e-8;
+  opts.min_eigenvalue = gicp.min_eigval;
+
+  bool icp_ok = false;
+
+  for (int i = 0; i < gicp.outer_iters; ++i) {
+    cost.ResetError();
+
+    t_match.Resume();
+    // Need to update cell tfs before match
+    grid.Interp(traj);
+    const auto n_matches = gicp.Match(grid, pano, gsize);
+    t_match.Stop(false);
+
+    if (n_matches < 10) {
+      LOG(WARNING) << "[grid.Match] Not enough matches: " << n_matches;
+      break;
+    }
+    VLOG(1) << "[grid.Match] num matched: " << n_matches;
+
+    // Build
+    t_solve.Resume();
+    cost.UpdateMatches(grid);
+    solver_.Solve(cost, cost.error.data());
+    cost.UpdateTraj(traj);
+    // Repropagate full trajectory from the starting point
+    const int n_imus = traj.PredictFull(imuq);
+    t_solve.Stop(false);
+    VLOG(1) << "[Traj.PredictFull] using imus: " << n_imus;
+
+    icp_ok = true;
+    if (i >= 2 && solver_.summary.IsConverged()) {
+      VLOG(1) << "[Icp] converged at outer: " << i + 1 << "/"
+              << gicp.outer_iters << ", inner: " << solver_.summary.iterations
+              << "/" << gicp.inner_iters;
+      break;
+    }
+  }
+
+  t_match.Commit();
+  t_solve.Commit();
+
+  // TODO (chao): need a better api
+  traj.cov = solver_.GetJtJ().inverse();
+  VLOG(1) << solver_.summary.Report();
+  sm.GetRef("grid.matches").Add(cost.matches.size());
+
+  return icp_ok;
+}
+
+bool OdomEngine::ShouldRender(const Sophus::SE3d& T_p1_p2,
+                              double match_ratio) const {
+  if (pano.render_ahead <= 0) {
+    return pano.ShouldRender(T_p1_p2.inverse(), match_ratio);
+  }
+
+  // Predict where lidar will be after render_ahead seconds, so that a
+  // background render could be done by the time it is needed
+  auto T_p1_p2_pred = T_p1_p2;
+  T_p1_p2_pred.translation() += traj.back().vel * pano.render_ahead;
+  return pano.ShouldRender(T_p1_p2_pred.inverse(), match_ratio);
+}
+
+std::optional<Sophus::SE3d> OdomEngine::PostProcess() {
+  const auto num_good_cells = grid.NumCandidates();
+  const auto num_matches = sm.GetRef("grid.matches").last();
+  const double match_ratio = num_matches / num_good_cells;
+  VLOG(1) << "[pano.RenderCheck] match ratio: " << match_ratio;
+
+  auto T_p1_p2 = traj.TfPanoLidar();
+  // Algin gravity means we will just set rotation to identity
+  if (pano.align_gravity) T_p1_p2.so3() = Sophus::SO3d{};
+
+  // We use the inverse from now on
+  const auto T_p2_p1 = T_p1_p2.inverse();
+
+  std::optional<Sophus::SE3d> T_odom_pano_prev;
+  int n_render = -1;
+  if (pano.rendering()) {
+    // Background render started in a previous scan, swap it in if done
+    n_render = pano.TrySwap(false, gsize);
+    if (n_render >= 0) {
+      T_odom_pano_prev = traj.T_odom_pano;
+      // Traj is moved to the lidar pose at which render was started
+      traj.MoveFrame(T_p2_p1_render_);
+    }
+  } else if (ShouldRender(T_p1_p2, match_ratio)) {
+    LOG(WARNING) << "=Render= sweeps: " << pano.num_sweeps
+                 << ", trans: " << T_p1_p2.translation().norm()
+                 << ", match: " << match_ratio * 100 << "% = " << num_matches
+                 << "/" << num_good_cells;
+
+    if (pano.async_render) {
+      // Render a snapshot of pano in background, scans are still matched to
+      // and added to the current pano until it is swapped, then points added
+      // meanwhile are fused again into the rendered one
+      auto _ = tm.Scoped("Render.Start");
+      pano.RenderAsync(T_p2_p1.cast<float>(), gsize);
+      T_p2_p1_render_ = T_p2_p1;
+    } else {
+      total_timer_.Stop();
+      {
+        auto _ = tm.Scoped("Render");
+        // Render pano at the latest lidar pose wrt pano (T_p1_p2 = T_p1_lidar)
+        n_render = pano.Render(T_p2_p1.cast<float>(), gsize);
+      }
+      total_timer_.Resume();
+      // Save current pano pose
+      T_odom_pano_prev = traj.T_odom_pano;
+      // Once rendering is done we need to update traj accordingly
+      traj.MoveFrame(T_p2_p1);
+    }
+  }
+
+  if (n_render > 0) {
+    sm.GetRef("pano.render_points").Add(n_render);
+    VLOG(1) << "[pano.Render] num render: " << n_render;
+  }
+
+  // 7. Keep traj in sweep for undistortion, poses are interpolated on demand
+  {
+    auto _ = tm.Scoped("7.Sweep.Interp");
+    sweep.SetTraj(traj);
+  }
+
+  grid.Interp(traj);
+  return T_odom_pano_prev;
+}
+
+void OdomEngine::UpdateTotal() {
+  // Wall time since PrepareScan() or AddScan(), stages may overlap so they
+  // cannot be summed. Render is excluded since it does not run every scan.
+  total_timer_.Stop();
+  TimerManager::StatsT stats;
+  stats.Add(absl::Nanoseconds(total_timer_.Elapsed()));
+  tm.Update("Total", stats);
+}
+
+}  // namespace sv
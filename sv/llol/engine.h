@@ -0,0 +1,121 @@
+#pragma once
+
+#include <functional>
+#include <optional>
+
+#include "sv/llol/cost.h"
+#include "sv/llol/gicp.h"
+#include "sv/llol/grid.h"
+#include "sv/llol/imu.h"
+#include "sv/llol/pano.h"
+#include "sv/llol/sweep.h"
+#include "sv/llol/traj.h"
+#include "sv/util/manager.h"
+#include "sv/util/nlls.h"
+#include "sv/util/timer.h"
+
+namespace sv {
+
+/// @struct Output of the engine after each scan
+struct OdomOutput {
+  double time{};                // time of the last column of the scan
+  bool icp_ok{false};           // whether registration succeeded
+  bool rendered{false};         // whether pano was rendered in this scan
+  Sophus::SE3d T_odom_lidar{};  // latest lidar pose in odom frame
+  Sophus::SE3d T_odom_pano{};   // current pano pose in odom frame
+  /// Pose of the pano that was just completed, only set when rendered
+  std::optional<Sophus::SE3d> T_odom_pano_prev;
+};
+
+/// @struct OdomEngine runs the whole odometry pipeline without any ros
+/// dependency. Scans are pushed in via AddScan() and imus via AddImu(), the
+/// result of each scan is passed to output_cb. Imus could also be pushed from
+/// another thread via PushImu(), they are moved to imuq by SyncImus().
+struct OdomEngine {
+  using OutputCallback = std::function<void(const OdomOutput&)>;
+
+  /// Params
+  int gsize{0};  // tbb grain size, <=0 means single thread, otherwise
+                 // independent stages of Preprocess() also run concurrently
+
+  /// Odom
+  ImuRing imu_ring{1024};  // imus pushed from another thread
+  ImuQueue imuq;
+  Trajectory traj;
+  LidarSweep sweep;
+  SweepGrid grid;
+  DepthPano pano;
+  GicpSolver gicp;
+  OutputCallback output_cb;
+
+  /// Stats
+  TimerManager tm{"llol"};
+  StatsManager sm{"llol"};
+
+  OdomEngine() = default;
+  OdomEngine(const OdomEngine&) = delete;
+  OdomEngine& operator=(const OdomEngine&) = delete;
+
+  /// @brief Allocate storage of sweep, grid and traj given sweep size
+  void InitLidar(const cv::Size& sweep_size,
+                 const GridParams& grid_params = {},
+                 const TrajectoryParams& traj_params = {},
+                 const GicpParams& gicp_params = {});
+  /// @brief Initialize extrinsics and gravity direction using imu queue
+  /// @return False if imu queue is not yet full
+  bool InitExtrinsics(const Sophus::SE3d& T_imu_lidar);
+
+  bool lidar_init() const noexcept { return !sweep.empty(); }
+  bool tf_init() const noexcept { return tf_init_; }
+  /// @brief Whether engine is ready to process scans
+  bool Ready() const { return lidar_init() && tf_init_ && imuq.full(); }
+
+  /// @brief Add imu data
+  void AddImu(const ImuData& imu) { imuq.Add(imu); }
+  /// @brief Push imu data from a single imu thread, lock-free
+  /// @return False if imu_ring is full and imu is dropped
+  bool PushImu(const ImuData& imu) { return imu_ring.Push(imu); }
+  /// @brief Move imus pushed so far to imuq, must be called from the thread
+  /// that processes scans, AddScan() calls it before processing
+  /// @return Number of imus moved
+  int SyncImus() { return imu_ring.PopInto(imuq); }
+
+  /// @brief Eject columns in curr to pano, after which a scan could be written
+  /// in place to sweep.mat.colRange(curr) and passed to AddScan()
+  void PrepareScan(const cv::Range& curr);
+
+  /// @brief Process a scan, which is either a standalone scan or a view of
+  /// sweep prepared by PrepareScan(). Calls output_cb when done.
+  void AddScan(const LidarScan& scan);
+
+  /// Stages, in the order they are run by AddScan()
+  void EjectScan(const cv::Range& curr);
+  /// @brief Run stages 1-4, ejecting curr to pano first if eject is true.
+  /// With gsize > 0 these run as a flow graph where 1.Pano.Add -> 2.Sweep.Add
+  /// and 3.Grid.Add -> 4.Imu.Integrate are two independent chains.
+  void Preprocess(const LidarScan& scan, bool eject = true);
+  bool Register();
+  bool IcpRigid();
+  /// @return Pose of the completed pano if pano was rendered
+  std::optional<Sophus::SE3d> PostProcess();
+  /// @brief Update total time of this scan
+  void UpdateTotal();
+
+ private:
+  /// Stages of Preprocess(), they only use thread-safe TimerManager so that
+  /// they could run concurrently, stats are added by the caller
+  int AddToPano(const cv::Range& curr);
+  int AddToSweep(const LidarScan& scan);
+  cv::Vec2i AddToGrid(const LidarScan& scan);
+  int PredictTraj();
+  /// @brief Whether to render pano, possibly ahead of time
+  bool ShouldRender(const Sophus::SE3d& T_p1_p2, double match_ratio) const;
+
+  bool tf_init_{false};
+  Timer total_timer_;  // wall time of a scan, excluding render
+  std::optional<GicpCostRigid> cost_;
+  NllsSolver solver_;
+  Sophus::SE3d T_p2_p1_render_;  // tf_p2_p1 of pending background render
+};
+
+}  // namespace sv
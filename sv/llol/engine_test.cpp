@@ -0,0 +1,200 @@
+#include "sv/llol/engine.h"
+
+#include <benchmark/benchmark.h>
+#include <gtest/gtest.h>
+
+namespace sv {
+namespace {
+
+constexpr int kImuRate = 100;
+constexpr double kSweepTime = 0.1;
+constexpr double kScanStart = 1.7;  // within time of imus in queue
+
+void InitTestEngine(OdomEngine& engine, const cv::Size& sweep_size) {
+  engine.imuq = ImuQueue{32};
+  engine.pano = DepthPano{{1024, 256}};
+  engine.InitLidar(sweep_size);
+
+  // Static imu for 2 seconds
+  for (int i = 0; i < 2 * kImuRate; ++i) {
+    ImuData imu;
+    imu.time = static_cast<double>(i) / kImuRate;
+    imu.acc.z() = 9.8;
+    engine.AddImu(imu);
+  }
+  engine.InitExtrinsics({});
+}
+
+TEST(EngineTest, TestDefault) {
+  OdomEngine engine;
+  EXPECT_FALSE(engine.lidar_init());
+  EXPECT_FALSE(engine.tf_init());
+  EXPECT_FALSE(engine.Ready());
+}
+
+TEST(EngineTest, TestInit) {
+  OdomEngine engine;
+  engine.imuq = ImuQueue{32};
+  engine.InitLidar({1024, 64});
+  EXPECT_TRUE(engine.lidar_init());
+  EXPECT_EQ(engine.traj.size(), engine.grid.cols() + 1);
+  // Imu queue not full
+  EXPECT_FALSE(engine.InitExtrinsics({}));
+  EXPECT_FALSE(engine.Ready());
+}
+
+TEST(EngineTest, TestAddScan) {
+  const cv::Size size{1024, 64};
+  OdomEngine engine;
+  InitTestEngine(engine, size);
+  ASSERT_TRUE(engine.Ready());
+
+  int num_outputs = 0;
+  double last_time = 0;
+  engine.output_cb = [&](const OdomOutput& output) {
+    ++num_outputs;
+    last_time = output.time;
+  };
+
+  const auto mat = MakeTestScan({size.width / 4, size.height}).mat;
+  const double dt = kSweepTime / size.width;
+  double time = kScanStart;
+  for (int i = 0; i < 8; ++i) {
+    const int c0 = (i % 4) * mat.cols;
+    time += dt * mat.cols;
+    const LidarScan scan(time, dt, 512.0, mat, {c0, c0 + mat.cols});
+    engine.AddScan(scan);
+  }
+
+  EXPECT_EQ(num_outputs, 8);
+  EXPECT_EQ(last_time, time);
+  EXPECT_EQ(engine.sweep.curr.end, size.width);
+}
+
+TEST(EngineTest, TestPushImu) {
+  const cv::Size size{1024, 64};
+  OdomEngine engine;
+  InitTestEngine(engine, size);
+
+  const auto last_time = engine.imuq.buf.back().time;
+  ImuData imu = engine.imuq.buf.back();
+  for (int i = 0; i < 10; ++i) {
+    imu.time += 1.0 / kImuRate;
+    EXPECT_TRUE(engine.PushImu(imu));
+  }
+  // Pushed imus are only visible after sync
+  EXPECT_EQ(engine.imuq.buf.back().time, last_time);
+  EXPECT_EQ(engine.imu_ring.size(), 10);
+
+  const auto mat = MakeTestScan({size.width / 4, size.height}).mat;
+  const double dt = kSweepTime / size.width;
+  engine.AddScan(LidarScan(kScanStart, dt, 512.0, mat, {0, mat.cols}));
+  EXPECT_EQ(engine.imuq.buf.back().time, imu.time);
+  EXPECT_TRUE(engine.imu_ring.empty());
+}
+
+TEST(EngineTest, TestAddScanInPlace) {
+  const cv::Size size{1024, 64};
+  OdomEngine engine;
+  InitTestEngine(engine, size);
+
+  const auto mat = MakeTestScan({size.width / 4, size.height}).mat;
+  const double dt = kSweepTime / size.width;
+  for (int i = 0; i < 4; ++i) {
+    const cv::Range curr{i * mat.cols, (i + 1) * mat.cols};
+    // Write scan directly into sweep storage
+    engine.PrepareScan(curr);
+    auto view = engine.sweep.mat.colRange(curr);
+    mat.copyTo(view);
+    const LidarScan scan(kScanStart + dt * curr.end, dt, 512.0, view, curr);
+    engine.AddScan(scan);
+  }
+
+  EXPECT_EQ(engine.sm.GetRef("pano.add_points").count(), 4);
+  EXPECT_EQ(engine.sweep.curr.end, size.width);
+}
+
+TEST(EngineTest, TestConcurrent) {
+  // Flow graph should give the same result as running stages in sequence
+  const cv::Size size{1024, 64};
+  OdomEngine engine0;
+  OdomEngine engine1;
+  engine1.gsize = 8;
+  InitTestEngine(engine0, size);
+  InitTestEngine(engine1, size);
+
+  const auto mat = MakeTestScan({size.width / 4, size.height}).mat;
+  const double dt = kSweepTime / size.width;
+  for (int i = 0; i < 8; ++i) {
+    const int c0 = (i % 4) * mat.cols;
+    const cv::Range curr{c0, c0 + mat.cols};
+    const double time = kScanStart + dt * (i + 1) * mat.cols;
+    const LidarScan scan(time, dt, 512.0, mat, curr);
+    engine0.AddScan(scan);
+    engine1.AddScan(scan);
+  }
+
+  for (const auto* name :
+       {"pano.add_points", "sweep.add", "grid.good_cells"}) {
+    EXPECT_EQ(engine0.sm.GetRef(name).sum(), engine1.sm.GetRef(name).sum());
+  }
+  EXPECT_EQ(engine0.traj.back().pos, engine1.traj.back().pos);
+  EXPECT_EQ(engine1.tm.GetStats("Preprocess").count(), 8);
+}
+
+TEST(EngineTest, TestAsyncRender) {
+  const cv::Size size{1024, 64};
+  OdomEngine engine;
+  InitTestEngine(engine, size);
+  engine.pano.async_render = true;
+  engine.pano.min_sweeps = 1;
+  // Always render once enough sweeps are added
+  engine.pano.min_match_ratio = 2.0;
+
+  int num_rendered = 0;
+  engine.output_cb = [&](const OdomOutput& output) {
+    num_rendered += output.rendered;
+  };
+
+  const auto mat = MakeTestScan({size.width / 4, size.height}).mat;
+  const double dt = kSweepTime / size.width;
+  for (int i = 0; i < 16; ++i) {
+    const int c0 = (i % 4) * mat.cols;
+    const double time = kScanStart + dt * (i + 1) * mat.cols;
+    engine.AddScan(LidarScan(time, dt, 512.0, mat, {c0, c0 + mat.cols}));
+  }
+  engine.pano.TrySwap(true);
+
+  EXPECT_GT(num_rendered, 0);
+  EXPECT_GT(engine.tm.GetStats("Render.Start").count(), 0);
+  EXPECT_FALSE(engine.pano.rendering());
+}
+
+void BM_EngineAddScan(benchmark::State& state) {
+  const cv::Size size{1024, 64};
+  OdomEngine engine;
+  engine.gsize = state.range(0);
+  InitTestEngine(engine, size);
+
+  const auto mat = MakeTestScan({size.width / 4, size.height}).mat;
+  const double dt = kSweepTime / size.width;
+  double time = kScanStart;
+  ImuData imu = engine.imuq.buf.back();
+  int i = 0;
+  for (auto _ : state) {
+    const int c0 = (i++ % 4) * mat.cols;
+    const cv::Range curr{c0, c0 + mat.cols};
+    time += dt * mat.cols;
+    // Keep imus ahead of scan
+    while (imu.time < time + kSweepTime) {
+      imu.time += 1.0 / kImuRate;
+      engine.AddImu(imu);
+    }
+    const LidarScan scan(time, dt, 512.0, mat, curr);
+    engine.AddScan(scan);
+  }
+}
+BENCHMARK(BM_EngineAddScan)->Arg(0)->Arg(16);
+
+}  // namespace
+}  // namespace sv
@@ -6,6 +6,8 @@
 #include <tbb/blocked_range.h>
 #include <tbb/parallel_reduce.h>
 
+#include <vector>
+
 #include "sv/llol/cost.h"
 #include "sv/util/ocv.h"
 
@@ -51,26 +53,50 @@ int GicpSolver::Match(SweepGrid& grid, const DepthPano& pano, int gsize) {
 }
 
 int GicpSolver::MatchRow(SweepGrid& grid, const DepthPano& pano, int gr) {
+  // Per thread buffers of grid points in pano frame
+  thread_local std::vector<float> xs, ys, zs, rgs;
+  thread_local std::vector<cv::Point> pxs;
+  const int cols = grid.cols();
+  xs.resize(cols);
+  ys.resize(cols);
+  zs.resize(cols);
+  rgs.resize(cols);
+  pxs.resize(cols);
+
+  // Transform to pano frame, bad cells get nan which projects to a bad pixel
+  for (int gc = 0; gc < cols; ++gc) {
+    const auto& match = grid.MatchAt({gc, gr});
+    if (!match.GridOk()) {
+      xs[gc] = ys[gc] = zs[gc] = rgs[gc] = kNaNF;
+      continue;
+    }
+    const auto pt_g = grid.TfAt(gc) * match.mc_g.mean;
+    xs[gc] = pt_g.x();
+    ys[gc] = pt_g.y();
+    zs[gc] = pt_g.z();
+    rgs[gc] = pt_g.norm();
+  }
+
+  // Project to pano in one go
+  pano.model.ForwardBatch(
+      cols, xs.data(), ys.data(), zs.data(), pxs.data(), pano.isa);
+
   int n = 0;
-  for (int gc = 0; gc < grid.cols(); ++gc) {
-    n += MatchCell(grid, pano, {gc, gr});
+  for (int gc = 0; gc < cols; ++gc) {
+    n += MatchCell(grid, pano, {gc, gr}, pxs[gc], rgs[gc]);
   }
   return n;
 }
 
 int GicpSolver::MatchCell(SweepGrid& grid,
                           const DepthPano& pano,
-                          const cv::Point& px_g) {
+                          const cv::Point& px_g,
+                          const cv::Point& px_p,
+                          float rg_g) {
   auto& match = grid.MatchAt(px_g);
   if (!match.GridOk()) return 0;
 
-  // Transform to pano frame
   const auto& T_p_g = grid.TfAt(px_g.x);
-  const auto pt_g = T_p_g * match.mc_g.mean;  // grid point in pano frame
-  const auto rg_g = pt_g.norm();  // range of grid point in pano frame
-
-  // Project to pano
-  const auto px_p = pano.model.Forward(pt_g.x(), pt_g.y(), pt_g.z(), rg_g);
   if (px_p.x < 0) {
     // Bad projection, reset pano and return
     match.ResetPano();
@@ -35,8 +35,14 @@ struct GicpSolver {
   /// @brief Match features in sweep to pano using mask
   /// @return Number of final matches
   int Match(SweepGrid& grid, const DepthPano& pano, int gsize = 0);
+  /// @brief Projects all cells of grid row gr to pano in batch, then matches
   int MatchRow(SweepGrid& grid, const DepthPano& pano, int gr);
-  int MatchCell(SweepGrid& grid, const DepthPano& pano, const cv::Point& px_g);
+  /// @brief Match cell px_g, given its projection px_p and range rg_g in pano
+  int MatchCell(SweepGrid& grid,
+                const DepthPano& pano,
+                const cv::Point& px_g,
+                const cv::Point& px_p,
+                float rg_g);
 };
 
 }  // namespace sv
@@ -7,7 +7,6 @@
 #include <tbb/parallel_reduce.h>
 
 #include <opencv2/core.hpp>
-#include <sophus/interpolate.hpp>
 
 #include "sv/util/ocv.h"
 
@@ -17,9 +16,11 @@ SweepGrid::SweepGrid(const cv::Size& sweep_size, const GridParams& params)
     : ScanBase{sweep_size / cv::Size{params.cell_cols, params.cell_rows},
                kDtype},
       nms{params.nms},
+      destaggered{params.destaggered},
       max_curve{params.max_curve},
       max_var{params.max_var},
-      cell_size{params.cell_cols, params.cell_rows} {
+      cell_size{params.cell_cols, params.cell_rows},
+      isa{BestIsa()} {
   CHECK_EQ(cell_size.width * cols(), sweep_size.width);
   CHECK_EQ(cell_size.height * rows(), sweep_size.height);
   CHECK_GE(cell_size.height, 1);
@@ -31,12 +32,15 @@ SweepGrid::SweepGrid(const cv::Size& sweep_size, const GridParams& params)
 
 std::string SweepGrid::Repr() const {
   return fmt::format(
-      "SweepGrid(size={}, cell_size={}, max_curve={}, max_var={}, nms={})",
+      "SweepGrid(size={}, cell_size={}, max_curve={}, max_var={}, nms={}, "
+      "destaggered={}, isa={})",
       sv::Repr(size()),
       sv::Repr(cell_size),
       max_curve,
       max_var,
-      nms);
+      nms,
+      destaggered,
+      static_cast<int>(isa));
 //  return (static_cast<std::stringstream&>(std::stringstream()
 //          << "SweepGrid(size=[ "<< sv::Repr(size()) <<
 //          " ], cell_size=[ " << sv::Repr(cell_size) <<
@@ -47,9 +51,27 @@ std::string SweepGrid::Repr() const {
 
 cv::Vec2i SweepGrid::Add(const LidarScan& scan, int gsize) {
   CHECK_EQ(scan.rows(), rows() * cell_size.height);
-  const int num_valid_cells = Score(scan, gsize);
-  const int num_match_dells = Filter(scan, gsize);
-  return {num_valid_cells, num_match_dells};
+  UpdateTime(scan.time, scan.dt * cell_size.width);
+  UpdateView(scan.curr / cell_size.width);
+
+  gsize = gsize <= 0 ? rows() : gsize;
+  return tbb::parallel_reduce(
+      tbb::blocked_range<int>(0, rows(), gsize),
+      cv::Vec2i{0, 0},
+      [&](const auto& blk, cv::Vec2i n) {
+        for (int r = blk.begin(); r < blk.end(); ++r) {
+          n += AddRow(scan, r);
+        }
+        return n;
+      },
+      std::plus<>{});
+}
+
+cv::Vec2i SweepGrid::AddRow(const LidarScan& scan, int r) {
+  // Scores of this row are still in cache when filtering
+  const int num_valid_cells = ScoreRow(scan, r);
+  const int num_good_cells = FilterRow(scan, r);
+  return {num_valid_cells, num_good_cells};
 }
 
 int SweepGrid::Score(const LidarScan& scan, int gsize) {
@@ -72,19 +94,12 @@ int SweepGrid::Score(const LidarScan& scan, int gsize) {
 }
 
 int SweepGrid::ScoreRow(const LidarScan& scan, int r) {
-  int n = 0;
-  for (int c = 0; c < curr.size(); ++c) {
-    // c starts from 0 in scan
-    const auto px_s = Grid2Sweep({c, r});
-    // Note that we only take the first row regardless of row size
-    // this is because ouster lidar image is staggered.
-    // Maybe we will handle destaggering it later
-    const auto curve = scan.CalcScore(px_s, cell_size.width);
-    // but the corresponding cell is within a sweep so need to offset
-    ScoreAt({c + curr.start, r}) = curve;  // could be nan
-    n += static_cast<int>(!std::isnan(curve[0]));
-  }
-  return n;
+  // Note that we only take the first row of a cell unless the scan is
+  // destaggered, this is because ouster lidar image is staggered.
+  // c starts from 0 in scan, but the corresponding cell is within a sweep so
+  // need to offset
+  auto* scores = &ScoreAt({curr.start, r});  // could be nan
+  return scan.CalcScoreRow(r * cell_size.height, CellUsed(), scores, isa);
 }
 
 int SweepGrid::Filter(const LidarScan& scan, int gsize) {
@@ -124,7 +139,7 @@ int SweepGrid::FilterRow(const LidarScan& scan, int r) {
     // Handle pad for nms
     if (pad <= c && c < curr.size() - pad && IsCellGood(px_g)) {
       // No need to offset for px scan
-      const cv::Rect rect{Grid2Sweep({c, r}), cell_size};
+      const cv::Rect rect{Grid2Sweep({c, r}), CellUsed()};
       scan.CalcMeanCovar(rect, match.mc_g);
       match.px_g = px_g;
       ++n;
@@ -157,13 +172,7 @@ void SweepGrid::Interp(const Trajectory& traj) {
     // Note that the starting point of traj is where curr ends, so we need to
     // offset by curr.end to find the corresponding traj segment
     const int tc = WrapCols(gc - curr.end, cols());
-    const auto& st0 = traj.At(tc);
-    const auto& st1 = traj.At(tc + 1);
-
-    Sophus::SE3d tf_p_i;
-    tf_p_i.so3() = Sophus::interpolate(st0.rot, st1.rot, 0.5);
-    tf_p_i.translation() = (st0.pos + st1.pos) / 2.0;
-    tfs.at(gc) = (tf_p_i * traj.T_imu_lidar).cast<float>();
+    tfs.at(gc) = InterpMid(traj.At(tc), traj.At(tc + 1), traj.T_imu_lidar);
   }
 }
 
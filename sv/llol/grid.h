@@ -9,9 +9,10 @@ namespace sv {
 struct GridParams {
   int cell_rows{2};
   int cell_cols{16};
-  bool nms{true};          // non-minimum suppression in Filter()
-  float max_curve{0.01F};  // score > max_score will be discarded
-  float max_var{0.01F};    // var > max_score will be discarded
+  bool nms{true};           // non-minimum suppression in Filter()
+  float max_curve{0.01F};   // score > max_score will be discarded
+  float max_var{0.01F};     // var > max_score will be discarded
+  bool destaggered{false};  // use all rows of cell, scan must be destaggered
 };
 
 /// @struct Sweep Grid summarizes sweep into reduced-sized grid
@@ -21,9 +22,11 @@ struct SweepGrid final : public ScanBase {
 
   /// Params
   bool nms{};
+  bool destaggered{};
   float max_curve{};
   float max_var{};
   cv::Size cell_size;
+  Isa isa{Isa::kScalar};  // score kernel, capped by BestIsa()
 
   /// Data
   std::vector<PointMatch> matches;  // all matches
@@ -37,8 +40,12 @@ struct SweepGrid final : public ScanBase {
     return os << rhs.Repr();
   }
 
-  /// @brief Score, Filter and Reduce
+  /// @brief Score, Filter and Reduce, fused in one pass over rows
+  /// @return Number of valid cells and good cells
   cv::Vec2i Add(const LidarScan& scan, int gsize = 0);
+  /// @brief Score and Filter a row, nms only looks at the same row so a row
+  /// could be filtered as soon as it is scored
+  cv::Vec2i AddRow(const LidarScan& scan, int r);
 
   /// @brief Score each cell of the incoming scan
   /// @param gsize is number of rows per task, <=0 means single thread
@@ -67,6 +74,10 @@ struct SweepGrid final : public ScanBase {
   cv::Point Grid2Sweep(const cv::Point& px) const {
     return {px.x * cell_size.width, px.y * cell_size.height};
   }
+  /// @brief Size of the part of a cell used for score and mean covar
+  cv::Size CellUsed() const {
+    return destaggered ? cell_size : cv::Size{cell_size.width, 1};
+  }
   int Px2Ind(const cv::Point& px) const { return px.y * cols() + px.x; }
 
   /// @brief Interpolate poses of each col (cell)
@@ -53,6 +53,96 @@ TEST(GridTest, TestScore) {
   std::cout << grid << std::endl;
 }
 
+TEST(GridTest, TestScoreRowIsa) {
+  // Number of cells is not a multiple of 8, so the avx2 kernel has leftovers
+  auto scan = MakeTestScan({1040, 64});
+  // Add some invalid pixels and range variations
+  for (int r = 0; r < scan.rows(); ++r) {
+    for (int c = 0; c < scan.cols(); ++c) {
+      auto& px = scan.mat.at<ScanPixel>(r, c);
+      if ((r * 7 + c) % 11 == 0) px.x = kNaNF;
+      px.range_raw += (r * 13 + c * 5) % 17;
+    }
+  }
+
+  for (const auto isa : {Isa::kScalar, Isa::kAvx2}) {
+    if (static_cast<int>(isa) > static_cast<int>(BestIsa())) continue;
+    for (const int width : {8, 16}) {
+      std::vector<cv::Vec2f> scores(scan.cols() / width);
+      // Single row and all rows of a destaggered cell
+      for (const cv::Size cell : {cv::Size{width, 1}, cv::Size{width, 2}}) {
+        for (int r = 0; r + cell.height <= scan.rows(); ++r) {
+          const int n = scan.CalcScoreRow(r, cell, scores.data(), isa);
+          int num_valid = 0;
+          for (int i = 0; i < scores.size(); ++i) {
+            const auto expected =
+                scan.CalcScore({i * width, r}, cell.width, cell.height);
+            num_valid += !std::isnan(expected[0]);
+            for (int k = 0; k < 2; ++k) {
+              if (std::isnan(expected[k])) {
+                ASSERT_TRUE(std::isnan(scores[i][k]));
+              } else if (isa == Isa::kScalar) {
+                // Scalar kernel is exactly the same as CalcScore
+                ASSERT_EQ(scores[i][k], expected[k]);
+              } else {
+                ASSERT_NEAR(scores[i][k], expected[k], 1e-5);
+              }
+            }
+          }
+          ASSERT_EQ(n, num_valid);
+        }
+      }
+    }
+  }
+}
+
+TEST(GridTest, TestDestaggered) {
+  // Destaggered grid uses all rows of a cell
+  const auto scan = MakeTestScan({1024, 64});
+  GridParams params;
+  SweepGrid grid0(scan.size(), params);
+  params.destaggered = true;
+  SweepGrid grid1(scan.size(), params);
+  EXPECT_EQ(grid0.CellUsed().height, 1);
+  EXPECT_EQ(grid1.CellUsed(), grid1.cell_size);
+
+  grid0.Add(scan);
+  grid1.Add(scan);
+  int n = 0;
+  for (int i = 0; i < grid0.total(); ++i) {
+    const auto& m0 = grid0.matches[i];
+    const auto& m1 = grid1.matches[i];
+    if (!m0.GridOk() || !m1.GridOk()) continue;
+    EXPECT_EQ(m1.mc_g.n, m0.mc_g.n * grid1.cell_size.height);
+    ++n;
+  }
+  EXPECT_GT(n, 0);
+}
+
+TEST(GridTest, TestAdd) {
+  // Fused Add should give the same result as Score then Filter
+  auto scan = MakeTestScan({1024, 64});
+  for (int r = 0; r < scan.rows(); ++r) {
+    for (int c = 0; c < scan.cols(); ++c) {
+      scan.mat.at<ScanPixel>(r, c).range_raw += (r * 13 + c * 5) % 17;
+    }
+  }
+  SweepGrid grid0(scan.size(), {2, 16, true, 1.0F, 1.0F});
+  SweepGrid grid1(scan.size(), {2, 16, true, 1.0F, 1.0F});
+
+  const int n_valid = grid0.Score(scan);
+  const int n_good = grid0.Filter(scan);
+  const auto n = grid1.Add(scan, 4);
+  EXPECT_EQ(n[0], n_valid);
+  EXPECT_EQ(n[1], n_good);
+  EXPECT_GT(n[1], 0);
+  EXPECT_EQ(grid0.NumCandidates(), grid1.NumCandidates());
+  for (int i = 0; i < grid0.total(); ++i) {
+    ASSERT_EQ(grid0.matches[i].px_g, grid1.matches[i].px_g);
+    ASSERT_EQ(grid0.matches[i].mc_g.n, grid1.matches[i].mc_g.n);
+  }
+}
+
 void BM_GridScore(benchmark::State& state) {
   const auto scan = MakeTestScan({1024, 64});
   SweepGrid grid(scan.size());
@@ -65,6 +155,38 @@ void BM_GridScore(benchmark::State& state) {
 }
 BENCHMARK(BM_GridScore)->Arg(0)->Arg(1)->Arg(2)->Arg(4)->Arg(8);
 
+void BM_GridScoreRow(benchmark::State& state) {
+  const auto scan = MakeTestScan({1024, 64});
+  const int width = 16;
+  const auto isa = static_cast<Isa>(state.range(0));
+  std::vector<cv::Vec2f> scores(scan.cols() / width);
+
+  for (auto _ : state) {
+    for (int r = 0; r < scan.rows(); ++r) {
+      benchmark::DoNotOptimize(
+          scan.CalcScoreRow(r, {width, 1}, scores.data(), isa));
+    }
+  }
+}
+BENCHMARK(BM_GridScoreRow)
+    ->Arg(static_cast<int>(Isa::kScalar))
+    ->Arg(static_cast<int>(Isa::kAvx2));
+
+void BM_GridScoreCell(benchmark::State& state) {
+  // Per cell CalcScore for comparison
+  const auto scan = MakeTestScan({1024, 64});
+  const int width = 16;
+
+  for (auto _ : state) {
+    for (int r = 0; r < scan.rows(); ++r) {
+      for (int c = 0; c < scan.cols(); c += width) {
+        benchmark::DoNotOptimize(scan.CalcScore({c, r}, width));
+      }
+    }
+  }
+}
+BENCHMARK(BM_GridScoreCell);
+
 void BM_GridFilter(benchmark::State& state) {
   const auto scan = MakeTestScan({1024, 64});
   SweepGrid grid(scan.size());
@@ -78,5 +200,16 @@ void BM_GridFilter(benchmark::State& state) {
 }
 BENCHMARK(BM_GridFilter)->Arg(0)->Arg(1)->Arg(2)->Arg(4)->Arg(8);
 
+void BM_GridAdd(benchmark::State& state) {
+  const auto scan = MakeTestScan({1024, 64});
+  SweepGrid grid(scan.size());
+  const int gsize = state.range(0);
+
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(grid.Add(scan, gsize));
+  }
+}
+BENCHMARK(BM_GridAdd)->Arg(0)->Arg(1)->Arg(2)->Arg(4)->Arg(8);
+
 }  // namespace
 }  // namespace sv
@@ -285,6 +285,71 @@ ImuData ImuQueue::CalcMean(int last_n) const {
   return mean;
 }
 
+/// ImuRing ====================================================================
+ImuRing::ImuRing(int capacity) {
+  CHECK_GT(capacity, 0);
+  size_t n = 1;
+  while (n < static_cast<size_t>(capacity)) n <<= 1;
+  buf_.resize(n);
+  mask_ = n - 1;
+}
+
+ImuRing& ImuRing::operator=(ImuRing&& rhs) noexcept {
+  buf_ = std::move(rhs.buf_);
+  mask_ = rhs.mask_;
+  head_.store(rhs.head_.load(std::memory_order_relaxed),
+              std::memory_order_relaxed);
+  tail_.store(rhs.tail_.load(std::memory_order_relaxed),
+              std::memory_order_relaxed);
+  rhs.mask_ = 0;
+  rhs.head_.store(0, std::memory_order_relaxed);
+  rhs.tail_.store(0, std::memory_order_relaxed);
+  return *this;
+}
+
+std::string ImuRing::Repr() const {
+  return fmt::format("ImuRing(size={}/{})", size(), capacity());
+}
+
+bool ImuRing::Push(const ImuData& imu) {
+  const auto tail = tail_.load(std::memory_order_relaxed);
+  // Full when producer is a whole ring ahead of consumer
+  if (tail - head_.load(std::memory_order_acquire) >= buf_.size()) {
+    return false;
+  }
+  buf_[tail & mask_] = imu;
+  // Publish data before the new tail is seen by consumer
+  tail_.store(tail + 1, std::memory_order_release);
+  return true;
+}
+
+bool ImuRing::Pop(ImuData& imu) {
+  const auto head = head_.load(std::memory_order_relaxed);
+  if (head == tail_.load(std::memory_order_acquire)) return false;
+  imu = buf_[head & mask_];
+  // Release the slot to producer only after it is read
+  head_.store(head + 1, std::memory_order_release);
+  return true;
+}
+
+int ImuRing::PopInto(ImuQueue& imuq) {
+  // Only take imus that are already pushed, so that the consumer works on a
+  // consistent snapshot even if producer keeps pushing
+  const auto head = head_.load(std::memory_order_relaxed);
+  const auto tail = tail_.load(std::memory_order_acquire);
+  for (auto i = head; i != tail; ++i) {
+    imuq.Add(buf_[i & mask_]);
+  }
+  head_.store(tail, std::memory_order_release);
+  return static_cast<int>(tail - head);
+}
+
+int ImuRing::size() const {
+  // Load head first so that size is never negative
+  const auto head = head_.load(std::memory_order_acquire);
+  return static_cast<int>(tail_.load(std::memory_order_acquire) - head);
+}
+
 /// ImuPreintegration ==========================================================
 int ImuPreintegration::Compute(const ImuQueue& imuq, double t0, double t1) {
   if ( (t1-t0) < 0 ) { LOG(WARNING) << "Compute dt > 0 ! t0: " << uint64_t(t0*1e9) << " t1: " << uint64_t(t1*1e9) << " s: " << imuq.size(); throw std::runtime_error(""); }
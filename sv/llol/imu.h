@@ -1,7 +1,9 @@
 #pragma once
 
+#include <atomic>
 #include <boost/circular_buffer.hpp>
 #include <sophus/se3.hpp>
+#include <vector>
 
 namespace sv {
 
@@ -138,6 +140,45 @@ struct ImuQueue {
   ImuData CalcMean(int last_n = 0) const;
 };
 
+/// @brief Lock-free single-producer single-consumer ring of imu data, so that
+/// imus could be received on one thread at full rate while another thread
+/// that processes lidar drains them into ImuQueue.
+/// @note Push() must only be called from one thread and Pop()/PopInto() from
+/// another. Moving is not thread-safe and is only meant for setup.
+class ImuRing {
+ public:
+  ImuRing() = default;
+  /// @brief Capacity is rounded up to power of 2
+  explicit ImuRing(int capacity);
+
+  ImuRing(ImuRing&& rhs) noexcept { *this = std::move(rhs); }
+  ImuRing& operator=(ImuRing&& rhs) noexcept;
+
+  std::string Repr() const;
+  friend std::ostream& operator<<(std::ostream& os, const ImuRing& rhs) {
+    return os << rhs.Repr();
+  }
+
+  /// @brief Producer, return false if ring is full and imu is dropped
+  bool Push(const ImuData& imu);
+  /// @brief Consumer, return false if ring is empty
+  bool Pop(ImuData& imu);
+  /// @brief Consumer, move all imus in ring to imuq
+  /// @return Number of imus moved
+  int PopInto(ImuQueue& imuq);
+
+  /// @brief Approximate when called while the other thread is running
+  int size() const;
+  bool empty() const { return size() == 0; }
+  int capacity() const { return buf_.size(); }
+
+ private:
+  std::vector<ImuData> buf_;
+  size_t mask_{0};
+  alignas(64) std::atomic<size_t> head_{0};  // next to pop, owned by consumer
+  alignas(64) std::atomic<size_t> tail_{0};  // next to push, owned by producer
+};
+
 /// @brief Imu preintegration
 struct ImuPreintegration {
   static constexpr int kDim = 15;
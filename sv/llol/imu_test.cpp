@@ -5,6 +5,7 @@
 #include <gtest/gtest.h>
 
 #include <sophus/interpolate.hpp>
+#include <thread>
 
 namespace sv {
 namespace {
@@ -35,6 +36,54 @@ TEST(ImuTest, TestFindNextImu) {
   EXPECT_EQ(GetImuIndexAfterTime(buffer, 15), 5);
 }
 
+TEST(ImuTest, TestImuRing) {
+  ImuRing ring(5);
+  EXPECT_EQ(ring.capacity(), 8);
+  EXPECT_TRUE(ring.empty());
+
+  ImuData imu;
+  for (int i = 0; i < 8; ++i) {
+    imu.time = i + 1;
+    EXPECT_TRUE(ring.Push(imu));
+  }
+  EXPECT_FALSE(ring.Push(imu));
+  EXPECT_EQ(ring.size(), 8);
+
+  ASSERT_TRUE(ring.Pop(imu));
+  EXPECT_EQ(imu.time, 1);
+
+  ImuQueue imuq(16);
+  EXPECT_EQ(ring.PopInto(imuq), 7);
+  EXPECT_EQ(imuq.size(), 7);
+  EXPECT_EQ(imuq.buf.back().time, 8);
+  EXPECT_TRUE(ring.empty());
+  EXPECT_FALSE(ring.Pop(imu));
+}
+
+TEST(ImuTest, TestImuRingThread) {
+  // Imus pushed from another thread arrive in order without loss
+  constexpr int kNumImus = 10000;
+  ImuRing ring(64);
+  ImuQueue imuq(kNumImus);
+
+  std::thread producer([&ring]() {
+    ImuData imu;
+    for (int i = 0; i < kNumImus; ++i) {
+      imu.time = i + 1;
+      while (!ring.Push(imu)) std::this_thread::yield();
+    }
+  });
+
+  while (imuq.size() < kNumImus) {
+    // ImuQueue::Add checks that time is increasing
+    if (ring.PopInto(imuq) == 0) std::this_thread::yield();
+  }
+  producer.join();
+
+  EXPECT_EQ(imuq.buf.front().time, 1);
+  EXPECT_EQ(imuq.buf.back().time, kNumImus);
+}
+
 TEST(ImuTest, TestImuPreintegration) {
   ImuQueue imuq;
   for (int i = 0; i < 5; ++i) {
@@ -96,5 +145,21 @@ void BM_InterpRot(benchmark::State& state) {
 }
 BENCHMARK(BM_InterpRot)->Arg(64)->Arg(128);
 
+void BM_ImuRingPushPop(benchmark::State& state) {
+  ImuRing ring(1024);
+  ImuQueue imuq(1024);
+  ImuData imu;
+  const int n = state.range(0);
+
+  for (auto _ : state) {
+    for (int i = 0; i < n; ++i) {
+      imu.time += 0.001;
+      ring.Push(imu);
+    }
+    benchmark::DoNotOptimize(ring.PopInto(imuq));
+  }
+}
+BENCHMARK(BM_ImuRingPushPop)->Arg(10)->Arg(100);
+
 }  // namespace
 }  // namespace sv
@@ -4,11 +4,155 @@
 #include <fmt/core.h>
 #include <glog/logging.h>
 
+#include <algorithm>
+#include <cmath>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SV_LIDAR_X86
+#include <immintrin.h>
+#endif
+
 #include "sv/util/math.h"
 #include "sv/util/ocv.h"
 
 namespace sv {
 
+namespace {
+
+static_assert(sizeof(cv::Point) == 2 * sizeof(int), "");
+
+/// Vertical fov spanned by beams
+float BeamsVfov(const std::vector<float>& beams) {
+  CHECK_GE(beams.size(), 2);
+  return beams.front() - beams.back();
+}
+
+#ifdef SV_LIDAR_X86
+
+/// Same as Atan2Approx() on 8 lanes
+__attribute__((target("avx2,fma"))) __m256 Atan2Avx2(__m256 y, __m256 x) {
+  const __m256 sign = _mm256_set1_ps(-0.0F);
+  const __m256 abs_x = _mm256_andnot_ps(sign, x);
+  const __m256 abs_y = _mm256_andnot_ps(sign, y);
+  const __m256 num = _mm256_min_ps(abs_x, abs_y);
+  const __m256 den =
+      _mm256_max_ps(_mm256_max_ps(abs_x, abs_y),
+                    _mm256_set1_ps(std::numeric_limits<float>::min()));
+  const __m256 t = _mm256_div_ps(num, den);
+  const __m256 t2 = _mm256_mul_ps(t, t);
+
+  __m256 angle = _mm256_set1_ps(0.0208351F);
+  angle = _mm256_fmadd_ps(angle, t2, _mm256_set1_ps(-0.0851330F));
+  angle = _mm256_fmadd_ps(angle, t2, _mm256_set1_ps(0.1801410F));
+  angle = _mm256_fmadd_ps(angle, t2, _mm256_set1_ps(-0.3302995F));
+  angle = _mm256_fmadd_ps(angle, t2, _mm256_set1_ps(0.9998660F));
+  angle = _mm256_mul_ps(angle, t);
+
+  const __m256 swap = _mm256_cmp_ps(abs_y, abs_x, _CMP_GT_OQ);
+  angle = _mm256_blendv_ps(
+      angle, _mm256_sub_ps(_mm256_set1_ps(M_PI_2), angle), swap);
+  const __m256 neg_x = _mm256_cmp_ps(x, _mm256_setzero_ps(), _CMP_LT_OQ);
+  angle = _mm256_blendv_ps(
+      angle, _mm256_sub_ps(_mm256_set1_ps(kPiF), angle), neg_x);
+  // copysign, angle is non-negative here
+  return _mm256_or_ps(angle, _mm256_and_ps(sign, y));
+}
+
+/// 8 points at a time, returns number of points done
+__attribute__((target("avx2,fma"))) int ForwardBatchAvx2(
+    const LidarModel& model,
+    int n,
+    const float* x,
+    const float* y,
+    const float* z,
+    cv::Point* px) {
+  const bool beams = model.has_beams();
+  const auto n_bins = static_cast<int>(model.row_lut.size());
+  const __m256 v_lut_min = _mm256_set1_ps(model.lut_min);
+  const __m256 v_lut_scale = _mm256_set1_ps(model.lut_scale);
+  const __m256 v_bound_top =
+      _mm256_set1_ps(beams ? model.row_bounds.front() : 0.0F);
+  const __m256 v_bound_bot =
+      _mm256_set1_ps(beams ? model.row_bounds.back() : 0.0F);
+  const __m256i v_bin_max = _mm256_set1_epi32(n_bins - 1);
+  const __m256i v_one = _mm256_set1_epi32(1);
+  const __m256 v_elev_max = _mm256_set1_ps(model.elev_max);
+  const __m256 v_elev_delta = _mm256_set1_ps(model.elev_delta);
+  const __m256 v_azim_delta = _mm256_set1_ps(model.azim_delta);
+  const __m256 v_rows = _mm256_set1_ps(static_cast<float>(model.size.height));
+  const __m256 v_cols = _mm256_set1_ps(static_cast<float>(model.size.width));
+  const __m256 v_zero = _mm256_setzero_ps();
+  const __m256 v_half = _mm256_set1_ps(0.5F);
+  const __m256 v_pi = _mm256_set1_ps(kPiF);
+  const __m256 v_sign = _mm256_set1_ps(-0.0F);
+  const __m256i v_bad = _mm256_set1_epi32(-1);
+
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    const __m256 vx = _mm256_loadu_ps(x + i);
+    const __m256 vy = _mm256_loadu_ps(y + i);
+    const __m256 vz = _mm256_loadu_ps(z + i);
+
+    const __m256 rxy2 = _mm256_fmadd_ps(vx, vx, _mm256_mul_ps(vy, vy));
+    const __m256 azim =
+        _mm256_add_ps(Atan2Avx2(vy, _mm256_xor_ps(vx, v_sign)), v_pi);
+    const __m256 col = _mm256_div_ps(azim, v_azim_delta);
+
+    // Ordered compares are false for nan
+    __m256 ok = _mm256_and_ps(_mm256_cmp_ps(col, v_zero, _CMP_GE_OQ),
+                              _mm256_cmp_ps(col, v_cols, _CMP_LT_OQ));
+    __m256i row_i;
+    if (beams) {
+      // Same as RowOfSin(), bins are clamped so that gathers of bad lanes
+      // stay in bound
+      const __m256 s = _mm256_div_ps(
+          vz, _mm256_sqrt_ps(_mm256_fmadd_ps(vz, vz, rxy2)));
+      ok = _mm256_and_ps(
+          ok,
+          _mm256_and_ps(_mm256_cmp_ps(s, v_bound_top, _CMP_LE_OQ),
+                        _mm256_cmp_ps(s, v_bound_bot, _CMP_GT_OQ)));
+      __m256i bin = _mm256_cvttps_epi32(
+          _mm256_mul_ps(_mm256_sub_ps(s, v_lut_min), v_lut_scale));
+      bin = _mm256_max_epi32(_mm256_min_epi32(bin, v_bin_max),
+                             _mm256_setzero_si256());
+      const __m256i row0 =
+          _mm256_i32gather_epi32(model.row_lut.data(), bin, 4);
+      const __m256 next = _mm256_i32gather_ps(
+          model.row_bounds.data(), _mm256_add_epi32(row0, v_one), 4);
+      // Mask is -1 if s is in next row
+      row_i = _mm256_sub_epi32(
+          row0, _mm256_castps_si256(_mm256_cmp_ps(s, next, _CMP_LE_OQ)));
+    } else {
+      const __m256 elev = Atan2Avx2(vz, _mm256_sqrt_ps(rxy2));
+      const __m256 row = _mm256_add_ps(
+          _mm256_div_ps(_mm256_sub_ps(v_elev_max, elev), v_elev_delta),
+          v_half);
+      ok = _mm256_and_ps(
+          ok,
+          _mm256_and_ps(_mm256_cmp_ps(row, v_zero, _CMP_GE_OQ),
+                        _mm256_cmp_ps(row, v_rows, _CMP_LT_OQ)));
+      row_i = _mm256_cvttps_epi32(row);
+    }
+
+    const __m256i ok_i = _mm256_castps_si256(ok);
+    const __m256i ri = _mm256_blendv_epi8(v_bad, row_i, ok_i);
+    const __m256i ci =
+        _mm256_blendv_epi8(v_bad, _mm256_cvttps_epi32(col), ok_i);
+
+    // Interleave to (col, row) pairs
+    const __m256i lo = _mm256_unpacklo_epi32(ci, ri);  // 0 1 | 4 5
+    const __m256i hi = _mm256_unpackhi_epi32(ci, ri);  // 2 3 | 6 7
+    auto* out = reinterpret_cast<__m256i*>(px + i);
+    _mm256_storeu_si256(out, _mm256_permute2x128_si256(lo, hi, 0x20));
+    _mm256_storeu_si256(out + 1, _mm256_permute2x128_si256(lo, hi, 0x31));
+  }
+  return i;
+}
+
+#endif
+
+}  // namespace
+
 /// LidarModel =================================================================
 LidarModel::LidarModel(const cv::Size& size_in, float vfov) : size{size_in} {
   if (vfov <= 0) {
@@ -34,6 +178,60 @@ LidarModel::LidarModel(const cv::Size& size_in, float vfov) : size{size_in} {
   }
 }
 
+LidarModel::LidarModel(const cv::Size& size_in, const std::vector<float>& beams)
+    : LidarModel(size_in, BeamsVfov(beams)) {
+  CHECK_GE(size.height, 2);
+  const int n_beams = static_cast<int>(beams.size());
+  for (int i = 1; i < n_beams; ++i) {
+    CHECK_LT(beams[i], beams[i - 1]) << "beams must be top to bottom";
+  }
+
+  // Elevation of each row, by linear interpolation of beam index
+  const int rows = size.height;
+  std::vector<float> elev(rows);
+  for (int i = 0; i < rows; ++i) {
+    const float p = i * (n_beams - 1.0F) / (rows - 1);
+    const int j = std::min(static_cast<int>(p), n_beams - 2);
+    const float t = p - j;
+    elev[i] = beams[j] * (1 - t) + beams[j + 1] * t;
+  }
+
+  elev_max = elev.front();
+  elev_delta = (elev.front() - elev.back()) / (rows - 1);
+  for (int i = 0; i < rows; ++i) elevs[i] = SinCosF{elev[i]};
+
+  // Rows are split half way between elevations, first and last rows extend
+  // the same amount beyond their elevation as towards their neighbor
+  row_bounds.resize(rows + 1);
+  row_bounds.front() = std::sin(elev[0] + (elev[0] - elev[1]) / 2);
+  for (int i = 1; i < rows; ++i) {
+    row_bounds[i] = std::sin((elev[i - 1] + elev[i]) / 2);
+  }
+  row_bounds.back() =
+      std::sin(elev[rows - 1] - (elev[rows - 2] - elev[rows - 1]) / 2);
+
+  // Bins are at most half as wide as the narrowest row
+  float min_gap = row_bounds.front() - row_bounds.back();
+  for (int i = 0; i < rows; ++i) {
+    min_gap = std::min(min_gap, row_bounds[i] - row_bounds[i + 1]);
+  }
+  CHECK_GT(min_gap, 0);
+  const float span = row_bounds.front() - row_bounds.back();
+  const int n_bins = static_cast<int>(std::ceil(span / min_gap * 2));
+  CHECK_LE(n_bins, 1 << 20) << "beams too close to each other";
+
+  lut_min = row_bounds.back();
+  lut_scale = n_bins / span;
+  row_lut.resize(n_bins);
+  int row = rows - 1;
+  for (int k = 0; k < n_bins; ++k) {
+    // Row of bin top, which only goes up as k goes up
+    const float top = lut_min + (k + 1) / lut_scale;
+    while (row > 0 && row_bounds[row] < top) --row;
+    row_lut[k] = row;
+  }
+}
+
 cv::Point LidarModel::Forward(float x, float y, float z, float r) const {
   cv::Point bad{-1, -1};
 
@@ -44,6 +242,40 @@ cv::Point LidarModel::Forward(float x, float y, float z, float r) const {
   return {col, row};
 }
 
+void LidarModel::ForwardBatch(int n,
+                              const float* x,
+                              const float* y,
+                              const float* z,
+                              cv::Point* px,
+                              Isa isa) const {
+  const auto rows_f = static_cast<float>(size.height);
+  const auto cols_f = static_cast<float>(size.width);
+  int i = 0;
+#ifdef SV_LIDAR_X86
+  if (isa == Isa::kAvx2) i = ForwardBatchAvx2(*this, n, x, y, z, px);
+#endif
+
+  // Remaining points, or all of them without avx2
+  for (; i < n; ++i) {
+    // Same as ToRow() and ToCol(), elev from atan2 is also fine near poles
+    const float rxy2 = x[i] * x[i] + y[i] * y[i];
+    const float azim = Atan2Approx(y[i], -x[i]) + kPiF;
+    const float col = azim / azim_delta;
+    float row;
+    if (has_beams()) {
+      row = RowOfSin(z[i] / std::sqrt(rxy2 + z[i] * z[i]));
+    } else {
+      const float elev = Atan2Approx(z[i], std::sqrt(rxy2));
+      // Row is rounded, + 0.5 then truncate is the same for row >= 0
+      row = (elev_max - elev) / elev_delta + 0.5F;
+    }
+    // Negated, so that nan is also bad
+    const bool bad = !(0 <= row && row < rows_f && 0 <= col && col < cols_f);
+    px[i].x = bad ? -1 : static_cast<int>(col);
+    px[i].y = bad ? -1 : static_cast<int>(row);
+  }
+}
+
 cv::Point3f LidarModel::Backward(int r, int c, float rg) const {
   //  CHECK_GT(rg, 0);
   const auto& elev = elevs.at(r);
@@ -51,12 +283,68 @@ cv::Point3f LidarModel::Backward(int r, int c, float rg) const {
   return {elev.cos * azim.cos * rg, elev.cos * azim.sin * rg, elev.sin * rg};
 }
 
+void LidarModel::BackwardRow(int r,
+                             int c0,
+                             int n,
+                             const float* rg,
+                             float* x,
+                             float* y,
+                             float* z) const {
+  if (has_rays()) {
+    // Plain loops over contiguous planes, so that they vectorize
+    const float* __restrict rx = ray_x.ptr<float>(r) + c0;
+    const float* __restrict ry = ray_y.ptr<float>(r) + c0;
+    const float* __restrict rz = ray_z.ptr<float>(r) + c0;
+    for (int i = 0; i < n; ++i) x[i] = rx[i] * rg[i];
+    for (int i = 0; i < n; ++i) y[i] = ry[i] * rg[i];
+    for (int i = 0; i < n; ++i) z[i] = rz[i] * rg[i];
+    return;
+  }
+
+  const auto& elev = elevs.at(r);
+  const auto* azim = &azims.at(c0);
+  for (int i = 0; i < n; ++i) {
+    x[i] = elev.cos * azim[i].cos * rg[i];
+    y[i] = elev.cos * azim[i].sin * rg[i];
+    z[i] = elev.sin * rg[i];
+  }
+}
+
+void LidarModel::InitRays() {
+  ray_x.create(size, CV_32FC1);
+  ray_y.create(size, CV_32FC1);
+  ray_z.create(size, CV_32FC1);
+  for (int r = 0; r < size.height; ++r) {
+    const auto& elev = elevs[r];
+    auto* px = ray_x.ptr<float>(r);
+    auto* py = ray_y.ptr<float>(r);
+    auto* pz = ray_z.ptr<float>(r);
+    for (int c = 0; c < size.width; ++c) {
+      px[c] = elev.cos * azims[c].cos;
+      py[c] = elev.cos * azims[c].sin;
+      pz[c] = elev.sin;
+    }
+  }
+}
+
 int LidarModel::ToRow(float z, float r) const {
   //  CHECK_GT(r, 0);
+  if (has_beams()) return RowOfSin(z / r);
   const float elev = std::asin(z / r);
   return std::round((elev_max - elev) / elev_delta);
 }
 
+int LidarModel::RowOfSin(float s) const {
+  if (s > row_bounds.front()) return -1;
+  // Negated, so that nan is also bad
+  if (!(s > row_bounds.back())) return size.height;
+  const int n_bins = static_cast<int>(row_lut.size());
+  const int bin = std::min(static_cast<int>((s - lut_min) * lut_scale),
+                           n_bins - 1);
+  const int row = row_lut[bin];
+  return s <= row_bounds[row + 1] ? row + 1 : row;
+}
+
 int LidarModel::ToCol(float x, float y) const {
   const float azim = std::atan2(y, -x) + kPiF;
   return static_cast<int>(azim / azim_delta);
@@ -84,11 +372,13 @@ int LidarModel::ToCol(float x, float y) const {
 std::string LidarModel::Repr() const {
   return fmt::format(
       "LidarModel(size={}, elev_max={:.2f}[deg], elev_delta={:.4f}[deg], "
-      "azim_delta={:.4f}[deg])",
+      "azim_delta={:.4f}[deg], rays={}, beams={})",
       sv::Repr(size),
       Rad2Deg(elev_max),
       Rad2Deg(elev_delta),
-      Rad2Deg(azim_delta));
+      Rad2Deg(azim_delta),
+      has_rays(),
+      has_beams());
 //  return (static_cast<std::stringstream&>(std::stringstream()
 //          << "LidarModel(size=[ "<< sv::Repr(size) <<
 //          " ], elev_max=[ " << Rad2Deg(elev_max) <<
@@ -1,7 +1,10 @@
 #pragma once
 
+#include <opencv2/core/mat.hpp>
 #include <opencv2/core/types.hpp>
+#include <vector>
 
+#include "sv/llol/scan.h"  // Isa
 #include "sv/util/math.h"  // SinCosF
 
 namespace sv {
@@ -10,6 +13,9 @@ namespace sv {
 struct LidarModel {
   LidarModel() = default;
   explicit LidarModel(const cv::Size& size_in, float vfov = 0.0F);
+  /// @brief Non-uniform model from beam elevations [rad], top to bottom. If
+  /// there are more rows than beams, elevations in between are interpolated.
+  LidarModel(const cv::Size& size_in, const std::vector<float>& beams);
 
   /// @brief Repr / <<
   std::string Repr() const;
@@ -19,12 +25,37 @@ struct LidarModel {
 
   /// @brief xyzr to pixel, bad result is {-1, -1}
   cv::Point Forward(float x, float y, float z, float r) const;
+  /// @brief Forward of n points in batch, using polynomial approximations of
+  /// atan2 instead of asin and atan2. Error is well below half a pixel, so
+  /// only points close to pixel borders could differ from Forward().
+  void ForwardBatch(int n,
+                    const float* x,
+                    const float* y,
+                    const float* z,
+                    cv::Point* px,
+                    Isa isa = Isa::kScalar) const;
   /// @brief pixel to xyz
   cv::Point3f Backward(int r, int c, float rg = 1.0) const;
+  /// @brief Backward of n pixels in row r starting at col c0, given their
+  /// ranges. Uses the ray table if initialized, otherwise elevs and azims.
+  void BackwardRow(int r,
+                   int c0,
+                   int n,
+                   const float* rg,
+                   float* x,
+                   float* y,
+                   float* z) const;
+
+  /// @brief Precompute unit ray of every pixel (3 float planes)
+  void InitRays();
+  bool has_rays() const noexcept { return !ray_x.empty(); }
 
   /// @brief compute row and col given xyzr
   int ToRow(float z, float r) const;
   int ToCol(float x, float y) const;
+  /// @brief Row of sin(elev) of a non-uniform model, -1 above and rows below
+  int RowOfSin(float s) const;
+  bool has_beams() const noexcept { return !row_lut.empty(); }
 
   //  cv::Point2f ForwardF(float x, float y, float z, float r) const;
   //  float ToRowF(float z, float r) const;
@@ -41,6 +72,15 @@ struct LidarModel {
   float azim_delta{};
   std::vector<SinCosF> elevs{};
   std::vector<SinCosF> azims{};
+  /// Unit rays, CV_32FC1 planes of size, only allocated by InitRays()
+  cv::Mat ray_x, ray_y, ray_z;
+  /// Non-uniform model only. Row r covers sin(elev) in (bounds[r+1],
+  /// bounds[r]]. Bins of lut are finer than rows, each holds the row at its
+  /// top, so there is at most one bound to check within a bin.
+  std::vector<float> row_bounds{};
+  std::vector<int> row_lut{};
+  float lut_min{};    // sin(elev) at the bottom of the first bin
+  float lut_scale{};  // bins per unit of sin(elev)
 };
 
 }  // namespace sv
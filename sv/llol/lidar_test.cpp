@@ -1,8 +1,11 @@
 #include "sv/llol/lidar.h"
 
+#include <benchmark/benchmark.h>
 #include <glog/logging.h>
 #include <gtest/gtest.h>
 
+#include <vector>
+
 namespace sv {
 namespace {
 
@@ -118,5 +121,220 @@ TEST(LidarTest, TestToCol) {
   EXPECT_EQ(lm.ToCol(1.0, 1.0), 7);
 }
 
+TEST(LidarTest, TestBackwardRow) {
+  LidarModel lm{{64, 16}};
+  const int c0 = 5;
+  const int n = 40;
+  std::vector<float> rgs(n), xs(n), ys(n), zs(n);
+  for (int i = 0; i < n; ++i) rgs[i] = 1.0F + i * 0.5F;
+
+  for (const bool rays : {false, true}) {
+    if (rays) lm.InitRays();
+    EXPECT_EQ(lm.has_rays(), rays);
+    for (int r = 0; r < lm.size.height; ++r) {
+      lm.BackwardRow(r, c0, n, rgs.data(), xs.data(), ys.data(), zs.data());
+      for (int i = 0; i < n; ++i) {
+        const auto pt = lm.Backward(r, c0 + i, rgs[i]);
+        EXPECT_FLOAT_EQ(xs[i], pt.x);
+        EXPECT_FLOAT_EQ(ys[i], pt.y);
+        EXPECT_FLOAT_EQ(zs[i], pt.z);
+      }
+    }
+  }
+}
+
+TEST(LidarTest, TestForwardBatch) {
+  const LidarModel lm{{1024, 64}, Deg2Rad(45.0F)};
+  const int n = 100000;
+  std::vector<float> xs(n), ys(n), zs(n);
+  std::vector<cv::Point> pxs(n);
+  for (int i = 0; i < n; ++i) {
+    const Eigen::Vector3f pt = Eigen::Vector3f::Random();
+    xs[i] = pt.x() * 20;
+    ys[i] = pt.y() * 20;
+    zs[i] = pt.z() * 10;
+  }
+  for (const auto isa : {Isa::kScalar, BestIsa()}) {
+    lm.ForwardBatch(n, xs.data(), ys.data(), zs.data(), pxs.data(), isa);
+
+    int num_diff = 0;
+    for (int i = 0; i < n; ++i) {
+      const float rg =
+          std::sqrt(xs[i] * xs[i] + ys[i] * ys[i] + zs[i] * zs[i]);
+      const auto px = lm.Forward(xs[i], ys[i], zs[i], rg);
+      if (px == pxs[i]) continue;
+      ++num_diff;
+
+      // Error is far below half a pixel, so a mismatch only happens when the
+      // exact pixel coordinate is right at a border
+      const float elev = std::asin(zs[i] / rg);
+      const float azim = std::atan2(ys[i], -xs[i]) + kPiF;
+      const float row = (lm.elev_max - elev) / lm.elev_delta + 0.5F;
+      const float col = azim / lm.azim_delta;
+      const float drow = std::abs(row - std::round(row));
+      const float dcol = std::abs(col - std::round(col));
+      EXPECT_LT(std::min(drow, dcol), 0.5F * 0.01F) << i;
+    }
+    EXPECT_LT(num_diff, n / 200);
+  }
+
+  // nan is bad, 9 points so that both simd and scalar loops are used
+  xs[0] = xs[8] = kNaNF;
+  for (const auto isa : {Isa::kScalar, BestIsa()}) {
+    lm.ForwardBatch(9, xs.data(), ys.data(), zs.data(), pxs.data(), isa);
+    EXPECT_EQ(pxs[0], cv::Point(-1, -1));
+    EXPECT_EQ(pxs[8], cv::Point(-1, -1));
+  }
+}
+
+/// Beam altitudes [deg] of a 32 beam sensor, dense around the horizon
+std::vector<float> MakeTestBeams() {
+  std::vector<float> beams;
+  for (int i = 0; i < 32; ++i) {
+    const float t = (i - 15.5F) / 15.5F;  // [-1, 1]
+    beams.push_back(Deg2Rad(-22.5F * t * std::abs(t) - 2.0F * t));
+  }
+  return beams;
+}
+
+TEST(LidarTest, TestBeams) {
+  const auto beams = MakeTestBeams();
+  const LidarModel lm{{1024, 32}, beams};
+  EXPECT_TRUE(lm.has_beams());
+  EXPECT_FLOAT_EQ(lm.elev_max, beams.front());
+  EXPECT_FLOAT_EQ(lm.elevs.back().sin, std::sin(beams.back()));
+
+  // Each beam maps to its own row, Backward is the inverse of Forward
+  for (int r = 0; r < lm.size.height; ++r) {
+    EXPECT_EQ(lm.ToRow(std::sin(beams[r]), 1), r);
+    const auto pt = lm.Backward(r, 100, 10);
+    EXPECT_EQ(lm.Forward(pt.x, pt.y, pt.z, 10), cv::Point(100, r));
+  }
+
+  // Rows are split half way between beams
+  for (int r = 1; r < lm.size.height; ++r) {
+    const float mid = (beams[r - 1] + beams[r]) / 2;
+    EXPECT_EQ(lm.ToRow(std::sin(mid + 1e-4F), 1), r - 1);
+    EXPECT_EQ(lm.ToRow(std::sin(mid - 1e-4F), 1), r);
+  }
+  EXPECT_EQ(lm.ToRow(std::sin(beams.front() + Deg2Rad(5.0F)), 1), -1);
+  EXPECT_EQ(lm.ToRow(std::sin(beams.back() - Deg2Rad(5.0F)), 1), 32);
+  EXPECT_EQ(lm.RowOfSin(kNaNF), 32);
+
+  // Same as nearest beam by brute force, both scalar and batch
+  const int n = 10000;
+  std::vector<float> xs(n), ys(n), zs(n);
+  std::vector<cv::Point> pxs(n);
+  for (int i = 0; i < n; ++i) {
+    const Eigen::Vector3f pt = Eigen::Vector3f::Random();
+    xs[i] = pt.x() * 20;
+    ys[i] = pt.y() * 20;
+    zs[i] = pt.z() * 10;
+  }
+  for (const auto isa : {Isa::kScalar, BestIsa()}) {
+    lm.ForwardBatch(n, xs.data(), ys.data(), zs.data(), pxs.data(), isa);
+    for (int i = 0; i < n; ++i) {
+      const float rg =
+          std::sqrt(xs[i] * xs[i] + ys[i] * ys[i] + zs[i] * zs[i]);
+      const float elev = std::asin(zs[i] / rg);
+      int nearest = 0;
+      for (int r = 1; r < lm.size.height; ++r) {
+        if (std::abs(beams[r] - elev) < std::abs(beams[nearest] - elev)) {
+          nearest = r;
+        }
+      }
+
+      const auto px = lm.Forward(xs[i], ys[i], zs[i], rg);
+      if (px.y < 0) {
+        // Outside of beams, nearest must be the first or last one
+        EXPECT_TRUE(nearest == 0 || nearest == lm.size.height - 1);
+        EXPECT_EQ(pxs[i].y, -1);
+        continue;
+      }
+      EXPECT_EQ(px.y, nearest) << i;
+      EXPECT_EQ(pxs[i].y, px.y) << i;
+    }
+  }
+}
+
+TEST(LidarTest, TestBeamsInterp) {
+  // 4 beams spread over 7 rows, rows in between are interpolated
+  const std::vector<float> beams{0.3F, 0.1F, 0.0F, -0.3F};
+  const LidarModel lm{{16, 7}, beams};
+  const std::vector<float> elevs{0.3, 0.2, 0.1, 0.05, 0.0, -0.15, -0.3};
+  for (int r = 0; r < lm.size.height; ++r) {
+    EXPECT_FLOAT_EQ(lm.elevs[r].sin, std::sin(elevs[r])) << r;
+    EXPECT_EQ(lm.ToRow(std::sin(elevs[r]), 1), r);
+  }
+}
+
+void BM_Forward(benchmark::State& state) {
+  // Second arg is 1 for non-uniform beams
+  const LidarModel lm = state.range(1)
+                            ? LidarModel{{1024, 32}, MakeTestBeams()}
+                            : LidarModel{{1024, 32}};
+  const int n = 4096;
+  std::vector<float> xs(n), ys(n), zs(n), rgs(n);
+  std::vector<cv::Point> pxs(n);
+  for (int i = 0; i < n; ++i) {
+    const Eigen::Vector3f pt = Eigen::Vector3f::Random();
+    xs[i] = pt.x() * 20;
+    ys[i] = pt.y() * 20;
+    zs[i] = pt.z() * 2;
+    rgs[i] = std::sqrt(xs[i] * xs[i] + ys[i] * ys[i] + zs[i] * zs[i]);
+  }
+
+  // 0 for Forward(), 1 for scalar batch, 2 for best simd batch
+  const int mode = state.range(0);
+  if (mode > 0) {
+    const auto isa = mode == 1 ? Isa::kScalar : BestIsa();
+    for (auto _ : state) {
+      lm.ForwardBatch(n, xs.data(), ys.data(), zs.data(), pxs.data(), isa);
+      benchmark::DoNotOptimize(pxs.data());
+    }
+  } else {
+    for (auto _ : state) {
+      for (int i = 0; i < n; ++i) {
+        pxs[i] = lm.Forward(xs[i], ys[i], zs[i], rgs[i]);
+      }
+      benchmark::DoNotOptimize(pxs.data());
+    }
+  }
+}
+BENCHMARK(BM_Forward)->ArgsProduct({{0, 1, 2}, {0, 1}});
+
+void BM_Backward(benchmark::State& state) {
+  const LidarModel lm{{1024, 64}};
+  std::vector<float> rgs(lm.size.width, 10.0F);
+  std::vector<cv::Point3f> pts(lm.size.width);
+
+  for (auto _ : state) {
+    for (int r = 0; r < lm.size.height; ++r) {
+      for (int c = 0; c < lm.size.width; ++c) {
+        pts[c] = lm.Backward(r, c, rgs[c]);
+      }
+      benchmark::DoNotOptimize(pts.data());
+    }
+  }
+}
+BENCHMARK(BM_Backward);
+
+void BM_BackwardRow(benchmark::State& state) {
+  LidarModel lm{{1024, 64}};
+  if (state.range(0)) lm.InitRays();
+  const int n = lm.size.width;
+  std::vector<float> rgs(n, 10.0F), xs(n), ys(n), zs(n);
+
+  for (auto _ : state) {
+    for (int r = 0; r < lm.size.height; ++r) {
+      lm.BackwardRow(r, 0, n, rgs.data(), xs.data(), ys.data(), zs.data());
+      benchmark::DoNotOptimize(xs.data());
+      benchmark::DoNotOptimize(ys.data());
+      benchmark::DoNotOptimize(zs.data());
+    }
+  }
+}
+BENCHMARK(BM_BackwardRow)->Arg(0)->Arg(1);
+
 }  // namespace
 }  // namespace sv
@@ -6,6 +6,9 @@
 #include <tbb/blocked_range.h>
 #include <tbb/parallel_reduce.h>
 
+#include <cstring>
+#include <vector>
+
 #include <opencv2/core.hpp>
 
 #include "sv/util/ocv.h"  // Repr
@@ -14,6 +17,88 @@ namespace sv {
 
 using Vector3f = Eigen::Vector3f;
 
+namespace {
+
+/// DepthPixel is 4 bytes, so it could be updated atomically as a 32-bit word
+static_assert(sizeof(DepthPixel) == sizeof(uint32_t), "");
+
+uint32_t* PixelWord(cv::Mat& mat, const cv::Point& px) {
+  return mat.ptr<uint32_t>(px.y) + px.x;
+}
+
+DepthPixel LoadPixel(const uint32_t* word) {
+  const uint32_t w = __atomic_load_n(word, __ATOMIC_RELAXED);
+  DepthPixel pixel;
+  std::memcpy(static_cast<void*>(&pixel), &w, sizeof(w));
+  return pixel;
+}
+
+/// Write desired if word still holds expected, otherwise expected is updated
+/// to the current pixel
+bool CasPixel(uint32_t* word, DepthPixel& expected, const DepthPixel& desired) {
+  uint32_t e;
+  uint32_t d;
+  std::memcpy(&e, &expected, sizeof(e));
+  std::memcpy(&d, &desired, sizeof(d));
+  if (__atomic_compare_exchange_n(
+          word, &e, d, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    return true;
+  }
+  std::memcpy(static_cast<void*>(&expected), &e, sizeof(e));
+  return false;
+}
+
+/// Per thread buffer of points in pano frame, projected in one batch
+struct PointBatch {
+  int n{};
+  std::vector<float> xs, ys, zs, rgs;
+  std::vector<int> cnts;  // only used by render
+  std::vector<cv::Point> pxs;
+
+  void Reset(int cap) {
+    n = 0;
+    xs.resize(cap);
+    ys.resize(cap);
+    zs.resize(cap);
+    rgs.resize(cap);
+    cnts.resize(cap);
+    pxs.resize(cap);
+  }
+
+  void Push(const Vector3f& pt, float rg, int cnt = 0) {
+    xs[n] = pt.x();
+    ys[n] = pt.y();
+    zs[n] = pt.z();
+    rgs[n] = rg;
+    cnts[n] = cnt;
+    ++n;
+  }
+
+  void Project(const LidarModel& model, Isa isa) {
+    model.ForwardBatch(n, xs.data(), ys.data(), zs.data(), pxs.data(), isa);
+  }
+};
+
+/// Project and fuse all points of batch into pano
+int FuseBatch(DepthPano& pano, PointBatch& batch) {
+  batch.Project(pano.model, pano.isa);
+
+  int n = 0;
+  for (int i = 0; i < batch.n; ++i) {
+    // Invalid pixel has nan range, which also fails this check
+    const auto rg_p = batch.rgs[i];
+    if (!(pano.min_range <= rg_p && rg_p <= pano.max_range)) continue;
+
+    const auto& px_p = batch.pxs[i];
+    if (px_p.x < 0 || px_p.y < 0) continue;
+
+    n += static_cast<int>(pano.FuseDepth(px_p, rg_p));
+  }
+  return n;
+}
+
+}  // namespace
+
 DepthPano::DepthPano(const cv::Size& size, const PanoParams& params)
     : max_cnt{params.max_cnt},
       min_sweeps{params.min_sweeps},
@@ -24,20 +109,37 @@ DepthPano::DepthPano(const cv::Size& size, const PanoParams& params)
       align_gravity{params.align_gravity},
       min_match_ratio{params.min_match_ratio},
       max_translation{params.max_translation},
-      model{size, params.vfov},
+      async_render{params.async_render},
+      render_ahead{params.render_ahead},
+      ray_table{params.ray_table},
+      isa{BestIsa()},
+      model{params.beams.empty() ? LidarModel{size, params.vfov}
+                                 : LidarModel{size, params.beams}},
       dbuf{size, CV_16UC2},
-      dbuf2{size, CV_16UC2} {
+      dbuf2{size, CV_16UC2},
+      mask{size.height, size.width},
+      mask2{size.height, size.width} {
   if (max_range <= 0) max_range = DepthPixel::kMaxRange;
   CHECK_LE(0, min_range);
   CHECK_LT(min_range, max_range);
   CHECK_LE(max_range, DepthPixel::kMaxRange);
+  if (ray_table) model.InitRays();
+  UpdateMask();
+}
+
+void DepthPano::UpdateMask() {
+  for (int r = 0; r < rows(); ++r) {
+    const auto* prow = dbuf.ptr<DepthPixel>(r);
+    for (int c = 0; c < cols(); ++c) mask.Set(r, c, prow[c].raw > 0);
+  }
 }
 
 std::string DepthPano::Repr() const {
   return fmt::format(
       "DepthPano(max_cnt={}, min_sweeps={}, min_range={}, max_range={}, "
       "win_ratio={}, fuse_ratio={}, match_ratio={}, align_gravity={}, "
-      "max_translation={}, model={}, dbuf={}, pixel=(scale={}, max_range={})",
+      "max_translation={}, async_render={}, render_ahead={}, ray_table={}, "
+      "isa={}, model={}, dbuf={}, pixel=(scale={}, max_range={})",
       max_cnt,
       min_sweeps,
       min_range,
@@ -47,6 +149,10 @@ std::string DepthPano::Repr() const {
       min_match_ratio,
       align_gravity,
       max_translation,
+      async_render,
+      render_ahead,
+      ray_table,
+      static_cast<int>(isa),
       model.Repr(),
       sv::Repr(dbuf),
       DepthPixel::kScale,
@@ -68,11 +174,10 @@ std::string DepthPano::Repr() const {
 }
 
 int DepthPano::Add(const LidarSweep& sweep, const cv::Range& curr, int gsize) {
-  gsize = gsize <= 0 ? sweep.rows() : gsize;
-
   // increment added sweep
   num_sweeps += static_cast<float>(curr.size()) / sweep.cols();
 
+  gsize = gsize <= 0 ? sweep.rows() : gsize;
   return tbb::parallel_reduce(
       tbb::blocked_range<int>(0, sweep.rows(), gsize),
       0,
@@ -86,32 +191,44 @@ int DepthPano::Add(const LidarSweep& sweep, const cv::Range& curr, int gsize) {
 }
 
 int DepthPano::AddRow(const LidarSweep& sweep, const cv::Range& curr, int sr) {
-  int n = 0;
-
-  for (int sc = curr.start; sc < curr.end; ++sc) {
-    const auto& pixel_s = sweep.PixelAt({sc, sr});
-    if (!pixel_s.Ok()) continue;
-
-    // Transform into pano frame
-    const auto pt_p = sweep.TfAt(sc) * pixel_s.Vec3fMap();
-    const auto rg_p = pt_p.norm();
-
-    // Ignore too far and too close stuff
-    if (rg_p < min_range || rg_p > max_range) continue;
-
-    // Project to pano
-    const auto px_p = model.Forward(pt_p.x(), pt_p.y(), pt_p.z(), rg_p);
-    if (px_p.x < 0 || px_p.y < 0) continue;
-
-    n += static_cast<int>(FuseDepth(px_p, rg_p));
+  thread_local PointBatch batch;
+  batch.Reset(curr.size());
+  const auto* prow = sweep.mat.ptr<ScanPixel>(sr);
+
+  // Only visit valid pixels, transform into pano frame
+  sweep.mask.ForEachSet(sr, curr.start, curr.end, [&](int sc) {
+    const auto pt_p = sweep.TfAt(sc) * prow[sc].Vec3fMap();
+    batch.Push(pt_p, pt_p.norm());
+  });
+
+  // Keep points for the pending background render, see TrySwap()
+  if (rendering()) {
+    auto it = pending_.grow_by(batch.n);
+    for (int i = 0; i < batch.n; ++i, ++it) {
+      *it = {batch.xs[i], batch.ys[i], batch.zs[i]};
+    }
   }
 
-  return n;
+  // Project to pano in one go
+  return FuseBatch(*this, batch);
 }
 
 bool DepthPano::FuseDepth(const cv::Point& px, float rg) {
-  auto& pixel = PixelAt(px);
+  // Rows are added in parallel and could hit the same pixel, so the fused
+  // pixel is only written if nobody changed it meanwhile, otherwise retry
+  auto* word = PixelWord(dbuf, px);
+  auto pixel = LoadPixel(word);
+  while (true) {
+    auto fused = pixel;
+    const bool ok = FusePixel(fused, rg);
+    if (CasPixel(word, pixel, fused)) {
+      if (pixel.raw == 0) mask.SetAtomic(px.y, px.x);
+      return ok;
+    }
+  }
+}
 
+bool DepthPano::FusePixel(DepthPixel& pixel, float rg) const {
   // If depth is 0, this is a new point and we give it a relatively large cnt
   if (pixel.raw == 0) {
     pixel.SetRangeCount(rg, max_cnt / 2);
@@ -170,35 +287,126 @@ bool DepthPano::ShouldRender(const Sophus::SE3d& tf_p2_p1,
 }
 
 int DepthPano::Render(Sophus::SE3f tf_p2_p1, int gsize) {
+  CHECK(!rendering()) << "Background render is pending";
+
   // clear pano2
   dbuf2.setTo(0);
+  mask2.Reset();
+  const int total = RenderImpl(dbuf, mask, dbuf2, mask2, tf_p2_p1, gsize);
+  cv::swap(dbuf, dbuf2);
+  swap(mask, mask2);
+
+  // set number of sweeps to 1
+  num_sweeps = 1;
+  return total;
+}
+
+void DepthPano::RenderAsync(const Sophus::SE3f& tf_p2_p1, int gsize) {
+  CHECK(!rendering()) << "Background render is pending";
+
+  // Only the snapshot is read by the task, dbuf is free to be updated
+  dbuf.copyTo(snap_);
+  snap_mask_ = mask;
+  next_.create(dbuf.size(), dbuf.type());
+  next_mask_ = BitMask{rows(), cols()};
+  render_tf_ = tf_p2_p1;
+  snap_sweeps_ = num_sweeps;
+  pending_.clear();
+
+  // One thread is kept for all renders instead of starting one each time
+  if (!worker_) worker_ = std::make_unique<Worker>();
+  render_ = worker_->Submit([this, tf_p2_p1, gsize]() {
+    next_.setTo(0);
+    return RenderImpl(snap_, snap_mask_, next_, next_mask_, tf_p2_p1, gsize);
+  });
+}
+
+int DepthPano::TrySwap(bool wait, int gsize) {
+  if (!rendering()) return -1;
+  if (!wait && render_.wait_for(std::chrono::seconds(0)) !=
+                   std::future_status::ready) {
+    return -1;
+  }
+
+  const int total = render_.get();
+  // Same as Render(), dbuf2 keeps the previous pano
+  cv::swap(dbuf2, dbuf);
+  cv::swap(dbuf, next_);
+  swap(mask2, mask);
+  swap(mask, next_mask_);
+
+  // Sweeps added after the snapshot are missing from the render, fuse them
+  // again in the new frame as if they were added after Render()
+  FusePending(render_tf_, gsize);
+  num_sweeps = 1 + (num_sweeps - snap_sweeps_);
+  return total;
+}
+
+int DepthPano::FusePending(const Sophus::SE3f& tf_p2_p1, int gsize) {
+  const int n = static_cast<int>(pending_.size());
+  constexpr int kBatch = 1024;
+  gsize = gsize <= 0 ? n : gsize * kBatch;
+
+  int total = 0;
+  if (n > 0) {
+    total = tbb::parallel_reduce(
+        tbb::blocked_range<int>(0, n, gsize),
+        0,
+        [&](const auto& blk, int m) {
+          thread_local PointBatch batch;
+          for (int i0 = blk.begin(); i0 < blk.end(); i0 += kBatch) {
+            const int i1 = std::min(i0 + kBatch, blk.end());
+            batch.Reset(i1 - i0);
+            for (int i = i0; i < i1; ++i) {
+              const auto pt2 = tf_p2_p1 * pending_[i];
+              batch.Push(pt2, pt2.norm());
+            }
+            m += FuseBatch(*this, batch);
+          }
+          return m;
+        },
+        std::plus<>{});
+  }
+
+  pending_.clear();
+  return total;
+}
+
+int DepthPano::RenderImpl(const cv::Mat& src,
+                          const BitMask& src_mask,
+                          cv::Mat& dst,
+                          BitMask& dst_mask,
+                          const Sophus::SE3f& tf_p2_p1,
+                          int gsize) const {
   gsize = gsize <= 0 ? rows() : gsize;
 
-  const int total = tbb::parallel_reduce(
+  return tbb::parallel_reduce(
       tbb::blocked_range<int>(0, rows(), gsize),
       0,
       [&](const auto& blk, int n) {
         for (int r = blk.begin(); r < blk.end(); ++r) {
-          n += RenderRow(tf_p2_p1, r);
+          n += RenderRow(src, src_mask, dst, dst_mask, tf_p2_p1, r);
         }
         return n;
       },
       std::plus<>{});
-
-  cv::swap(dbuf, dbuf2);
-
-  // set number of sweeps to 1
-  num_sweeps = 1;
-  return total;
 }
 
-int DepthPano::RenderRow(const Sophus::SE3f& tf_p2_p1, int r1) {
-  int n = 0;
-
-  for (int c1 = 0; c1 < cols(); ++c1) {
-    const auto& dp1 = PixelAt({c1, r1});
-    // We skip pixel that is empty or uncertainy
-    if (dp1.raw == 0 || dp1.cnt < max_cnt / 4) continue;
+int DepthPano::RenderRow(const cv::Mat& src,
+                         const BitMask& src_mask,
+                         cv::Mat& dst,
+                         BitMask& dst_mask,
+                         const Sophus::SE3f& tf_p2_p1,
+                         int r1) const {
+  thread_local PointBatch batch;
+  batch.Reset(cols());
+  const auto* prow = src.ptr<DepthPixel>(r1);
+
+  // Empty pixels are skipped by the mask
+  src_mask.ForEachSet(r1, 0, cols(), [&](int c1) {
+    const auto& dp1 = prow[c1];
+    // We skip pixel that is uncertainy
+    if (dp1.cnt < max_cnt / 4) return;
 
     // px1 -> xyz1
     const auto pt1 = model.Backward(r1, c1, dp1.GetRange());
@@ -208,35 +416,50 @@ int DepthPano::RenderRow(const Sophus::SE3f& tf_p2_p1, int r1) {
     const auto pt2 = tf_p2_p1 * pt1_map;
     const auto rg2 = pt2.norm();
 
-    if (rg2 < min_range || rg2 > max_range) continue;
+    if (rg2 < min_range || rg2 > max_range) return;
+    batch.Push(pt2, rg2, dp1.cnt);
+  });
+
+  // xyz2 -> px2
+  batch.Project(model, isa);
 
-    // xyz2 -> px2
-    const auto px2 = model.Forward(pt2.x(), pt2.y(), pt2.z(), rg2);
+  int n = 0;
+  for (int i = 0; i < batch.n; ++i) {
+    const auto& px2 = batch.pxs[i];
     if (px2.x < 0) continue;
 
     // Check for occlusion
-    n += UpdateBuffer(px2, rg2, dp1.cnt);
+    n += UpdateBuffer(dst, dst_mask, px2, batch.rgs[i], batch.cnts[i]);
   }
 
   return n;
 }
 
-bool DepthPano::UpdateBuffer(const cv::Point& px, float rg, int cnt) {
-  auto& pixel = dbuf2.at<DepthPixel>(px);
+bool DepthPano::UpdateBuffer(cv::Mat& dst,
+                             BitMask& dst_mask,
+                             const cv::Point& px,
+                             float rg,
+                             int cnt) const {
+  // Same as FuseDepth(), different rows could render to the same pixel
+  auto* word = PixelWord(dst, px);
+  auto pixel = LoadPixel(word);
+  while (true) {
+    // if the destination pixel is empty, or the new rg is smaller than the old
+    // one, we update the depth
+    if (pixel.raw != 0 && rg >= pixel.GetRange()) return false;
 
-  // if the destination pixel is empty, or the new rg is smaller than the old
-  // one, we update the depth
-  if (pixel.raw == 0 || rg < pixel.GetRange()) {
     // When rendering a new depth pano, if the original pixel is well estimated
     // (high cnt), this means that it also has good visibility from the current
     // viewpoint. On the other hand, if it has low cnt, this means that it was
     // probably occluded. Therefore, we simply half the original cnt and make it
     // the new one
-    pixel.SetRangeCount(rg, cnt / 2);
-    return true;
+    DepthPixel rendered;
+    rendered.SetRangeCount(rg, cnt / 2);
+    if (CasPixel(word, pixel, rendered)) {
+      if (pixel.raw == 0) dst_mask.SetAtomic(px.y, px.x);
+      return true;
+    }
   }
-
-  return false;
 }
 
 float DepthPano::CalcMeanCovar(cv::Rect win, float rg, MeanCovar3f& mc) const {
@@ -245,20 +468,32 @@ float DepthPano::CalcMeanCovar(cv::Rect win, float rg, MeanCovar3f& mc) const {
   // Make sure window is within bound
   win = win & cv::Rect{cv::Point{}, size()};
 
+  // Ranges of one window row, dissimilar ones are zeroed
+  thread_local std::vector<float> rgs, xs, ys, zs;
+  rgs.resize(win.width);
+  xs.resize(win.width);
+  ys.resize(win.width);
+  zs.resize(win.width);
+
   float weight = 0.0;
   for (int wr = 0; wr < win.height; ++wr) {
+    const int r = wr + win.y;
+    const auto* prow = dbuf.ptr<DepthPixel>(r) + win.x;
     for (int wc = 0; wc < win.width; ++wc) {
-      const cv::Point px_w{wc + win.x, wr + win.y};
-      const auto& dp = PixelAt(px_w);
-      const auto rg_w = dp.GetRange();
-
+      const auto rg_w = prow[wc].GetRange();
       // Check for validity and range similarity
-      if (rg_w == 0 || (std::abs(rg_w - rg) / rg) > win_ratio) continue;
+      const bool ok = rg_w > 0 && (std::abs(rg_w - rg) / rg) <= win_ratio;
+      rgs[wc] = ok ? rg_w : 0.0F;
+    }
 
-      // Add 3d point
-      const auto pt = model.Backward(px_w.y, px_w.x, rg_w);
-      mc.Add({pt.x, pt.y, pt.z});
-      weight += dp.cnt;
+    model.BackwardRow(
+        r, win.x, win.width, rgs.data(), xs.data(), ys.data(), zs.data());
+
+    // Add 3d points
+    for (int wc = 0; wc < win.width; ++wc) {
+      if (rgs[wc] == 0) continue;
+      mc.Add({xs[wc], ys[wc], zs[wc]});
+      weight += prow[wc].cnt;
     }
   }
 
@@ -1,7 +1,13 @@
 #pragma once
 
+#include <tbb/concurrent_vector.h>
+
+#include <future>
+#include <memory>
+
 #include "sv/llol/lidar.h"
 #include "sv/llol/sweep.h"
+#include "sv/util/worker.h"
 
 namespace sv {
 
@@ -34,6 +40,10 @@ struct PanoParams {
   bool align_gravity{false};
   double min_match_ratio{0.9};
   double max_translation{1.5};
+  bool async_render{false};  // render in background
+  double render_ahead{0.0};  // predict translation ahead of time [s]
+  bool ray_table{false};  // precompute unit ray of every pixel
+  std::vector<float> beams{};  // beam elevations top to bottom [rad]
 };
 
 /// @class Depth Panorama
@@ -48,11 +58,17 @@ struct DepthPano {
   bool align_gravity{};
   double min_match_ratio{};
   double max_translation{};
+  bool async_render{};
+  double render_ahead{};
+  bool ray_table{};
+  Isa isa{Isa::kScalar};  // simd kernel of projection
 
   /// Data
   LidarModel model;
   cv::Mat dbuf;
-  cv::Mat dbuf2;
+  cv::Mat dbuf2;  // previous pano after render
+  BitMask mask;   // bit is set if raw of dbuf is not 0
+  BitMask mask2;  // same for dbuf2
   float num_sweeps{-1};  // number of sweeps added
 
   /// @brief Ctors
@@ -74,14 +90,42 @@ struct DepthPano {
   /// @brief Add a partial sweep to the pano
   int Add(const LidarSweep& sweep, const cv::Range& curr, int gsize = 0);
   int AddRow(const LidarSweep& sweep, const cv::Range& curr, int row);
+  /// @brief Fuse rg into pixel px of dbuf, thread-safe
   bool FuseDepth(const cv::Point& px, float rg);
+  /// @brief Fuse rg into a copy of pixel
+  bool FusePixel(DepthPixel& pixel, float rg) const;
+  /// @brief Rebuild mask from dbuf, needed after dbuf is written directly
+  void UpdateMask();
+  /// @brief Number of pixels with depth
+  int num_valid() const { return mask.Count(); }
 
   /// @brief Render pano at a new location
   /// @note frame difference, ones is T_p1_p2, the other is T_p2_p1
   bool ShouldRender(const Sophus::SE3d& tf_p2_p1, double match_ratio) const;
   int Render(Sophus::SE3f tf_p2_p1, int gsize = 0);
-  int RenderRow(const Sophus::SE3f& tf_p2_p1, int row);
-  bool UpdateBuffer(const cv::Point& px, float rg, int cnt);
+  int RenderRow(const cv::Mat& src,
+                const BitMask& src_mask,
+                cv::Mat& dst,
+                BitMask& dst_mask,
+                const Sophus::SE3f& tf_p2_p1,
+                int row) const;
+  /// @brief Z-buffer update of pixel px in dst, thread-safe
+  bool UpdateBuffer(cv::Mat& dst,
+                    BitMask& dst_mask,
+                    const cv::Point& px,
+                    float rg,
+                    int cnt) const;
+
+  /// @brief Start rendering a snapshot of dbuf in background, sweeps could
+  /// still be added to dbuf meanwhile. Result is swapped in by TrySwap().
+  /// @note pano must not be moved while rendering
+  void RenderAsync(const Sophus::SE3f& tf_p2_p1, int gsize = 0);
+  /// @brief Swap in the background render if it is done, or wait for it.
+  /// Points added after the snapshot are fused again into the rendered pano,
+  /// so the result is the same as Render() followed by those Add().
+  /// @return Number of rendered points, -1 if not done or not rendering
+  int TrySwap(bool wait = false, int gsize = 0);
+  bool rendering() const { return render_.valid(); }
 
   /// @brief info
   int rows() const { return dbuf.rows; }
@@ -98,6 +142,28 @@ struct DepthPano {
   /// @brief Viz
   const std::vector<cv::Mat>& DrawRangeCount() const;
   const std::vector<cv::Mat>& DrawRangeCount2() const;
+
+ private:
+  int RenderImpl(const cv::Mat& src,
+                 const BitMask& src_mask,
+                 cv::Mat& dst,
+                 BitMask& dst_mask,
+                 const Sophus::SE3f& tf_p2_p1,
+                 int gsize) const;
+
+  /// @brief Fuse pending points into dbuf, transformed by tf_p2_p1
+  int FusePending(const Sophus::SE3f& tf_p2_p1, int gsize);
+
+  cv::Mat snap_;             // snapshot of dbuf for background render
+  cv::Mat next_;             // background render target
+  BitMask snap_mask_;        // mask of snap_
+  BitMask next_mask_;        // mask of next_
+  Sophus::SE3f render_tf_;   // tf_p2_p1 of background render
+  float snap_sweeps_{};      // num_sweeps when snapshot was taken
+  /// Points added to dbuf after the snapshot, in frame of the current pano
+  tbb::concurrent_vector<Eigen::Vector3f> pending_;
+  std::future<int> render_;
+  std::unique_ptr<Worker> worker_;  // last member, so render is done first
 };
 
 }  // namespace sv
@@ -2,6 +2,9 @@
 
 #include <benchmark/benchmark.h>
 #include <gtest/gtest.h>
+#include <tbb/task_arena.h>
+
+#include <thread>
 
 #include "sv/llol/scan.h"  // MakeTestScan
 
@@ -17,6 +20,179 @@ TEST(DepthPanoTest, TestCtor) {
   std::cout << dp << std::endl;
 }
 
+TEST(DepthPanoTest, TestRenderAsync) {
+  const auto sweep = MakeTestSweep({1024, 64});
+  DepthPano pano0({1024, 256});
+  DepthPano pano1({1024, 256});
+  pano0.Add(sweep, sweep.curr);
+  pano1.Add(sweep, sweep.curr);
+
+  Sophus::SE3f tf;
+  tf.translation().x() = 0.5;
+  const int n0 = pano0.Render(tf);
+  // Sweep added after render is in the new frame
+  auto sweep2 = sweep;
+  for (auto& tf_c : sweep2.tfs) tf_c = tf * tf_c;
+  pano0.Add(sweep2, sweep2.curr);
+
+  EXPECT_EQ(pano1.TrySwap(), -1);
+  pano1.RenderAsync(tf);
+  EXPECT_TRUE(pano1.rendering());
+  // Sweep added during render is fused again after swap
+  pano1.Add(sweep, sweep.curr);
+  const int n1 = pano1.TrySwap(true);
+  EXPECT_FALSE(pano1.rendering());
+
+  EXPECT_GT(n0, 0);
+  EXPECT_EQ(n0, n1);
+  EXPECT_EQ(pano1.num_sweeps, pano0.num_sweeps);
+  // Transforms are composed in a different order, so a few pixels could differ
+  int num_diff = 0;
+  for (int r = 0; r < pano0.rows(); ++r) {
+    for (int c = 0; c < pano0.cols(); ++c) {
+      num_diff += pano0.PixelAt({c, r}).raw != pano1.PixelAt({c, r}).raw;
+    }
+  }
+  EXPECT_LE(num_diff, pano0.num_valid() / 100);
+  EXPECT_EQ(pano0.num_valid(), pano1.num_valid());
+  EXPECT_EQ(pano0.dbuf2.size(), pano1.dbuf2.size());
+
+  // Worker is reused by the next render
+  pano1.RenderAsync(tf);
+  EXPECT_GT(pano1.TrySwap(true), 0);
+}
+
+TEST(DepthPanoTest, TestMask) {
+  const auto count_raw = [](const DepthPano& pano) {
+    int n = 0;
+    for (int r = 0; r < pano.rows(); ++r) {
+      for (int c = 0; c < pano.cols(); ++c) n += pano.PixelAt({c, r}).raw > 0;
+    }
+    return n;
+  };
+
+  DepthPano pano({1024, 256});
+  pano.dbuf.setTo(0);
+  pano.UpdateMask();
+  EXPECT_EQ(pano.num_valid(), 0);
+
+  const auto sweep = MakeTestSweep({1024, 64});
+  pano.Add(sweep, sweep.curr);
+  EXPECT_GT(pano.num_valid(), 0);
+  EXPECT_EQ(pano.num_valid(), count_raw(pano));
+
+  // Mask follows dbuf after render
+  pano.Render({});
+  EXPECT_EQ(pano.num_valid(), count_raw(pano));
+  for (int r = 0; r < pano.rows(); ++r) {
+    for (int c = 0; c < pano.cols(); ++c) {
+      ASSERT_EQ(pano.mask.Test(r, c), pano.PixelAt({c, r}).raw > 0);
+    }
+  }
+}
+
+TEST(DepthPanoTest, TestParallel) {
+  // Parallel add and render give the same pixels as serial ones
+  const auto sweep = MakeTestSweep({1024, 64});
+  Sophus::SE3f tf;
+  tf.translation().x() = 0.5;
+
+  // Smaller than sweep, so that different rows project to the same pixel
+  DepthPano pano0({512, 32});
+  DepthPano pano1({512, 32});
+  pano0.dbuf.setTo(0);
+  pano0.UpdateMask();
+  pano1.dbuf.setTo(0);
+  pano1.UpdateMask();
+  // Use more threads than cores so that rows really run concurrently
+  tbb::task_arena arena(4);
+  int n_add = 0;
+  int n_render = 0;
+  arena.execute([&] {
+    n_add = pano1.Add(sweep, sweep.curr, 1);
+    n_render = pano1.Render(tf, 1);
+  });
+
+  EXPECT_EQ(pano0.Add(sweep, sweep.curr, 0), n_add);
+  EXPECT_EQ(pano0.Render(tf, 0), n_render);
+  EXPECT_EQ(pano0.num_valid(), pano1.num_valid());
+  for (int r = 0; r < pano0.rows(); ++r) {
+    for (int c = 0; c < pano0.cols(); ++c) {
+      ASSERT_EQ(pano0.PixelAt({c, r}).raw, pano1.PixelAt({c, r}).raw);
+    }
+  }
+}
+
+TEST(DepthPanoTest, TestFuseConcurrent) {
+  // Threads that hit the same pixels at the same time lose no update, the
+  // results are checked here and data races are reported when built with
+  // ENABLE_SANITIZER_THREAD
+  constexpr int kNumThreads = 4;
+  constexpr int kNumRounds = 100;
+  DepthPano pano({32, 8});
+  pano.max_cnt = 20000;
+  pano.dbuf.setTo(0);
+  pano.UpdateMask();
+  const int num_pixels = pano.rows() * pano.cols();
+
+  // Same range every time, so each fuse is a weighted update that adds 1 cnt
+  constexpr float kRange = 4.0F;
+  std::vector<std::thread> threads;
+  std::vector<int> n_fuse(kNumThreads, 0);
+  for (int t = 0; t < kNumThreads; ++t) {
+    threads.emplace_back([&pano, &n = n_fuse[t]]() {
+      for (int k = 0; k < kNumRounds; ++k) {
+        for (int r = 0; r < pano.rows(); ++r) {
+          for (int c = 0; c < pano.cols(); ++c) {
+            n += pano.FuseDepth({c, r}, kRange);
+          }
+        }
+      }
+    });
+  }
+  for (auto& th : threads) th.join();
+  threads.clear();
+
+  for (const auto n : n_fuse) EXPECT_EQ(n, kNumRounds * num_pixels);
+  EXPECT_EQ(pano.num_valid(), num_pixels);
+  for (int r = 0; r < pano.rows(); ++r) {
+    for (int c = 0; c < pano.cols(); ++c) {
+      const auto& pixel = pano.PixelAt({c, r});
+      ASSERT_EQ(pixel.GetRange(), kRange);
+      // First fuse sets max_cnt / 2, every other one adds 1
+      ASSERT_EQ(pixel.cnt, pano.max_cnt / 2 + kNumThreads * kNumRounds - 1);
+    }
+  }
+
+  // Concurrent z-buffer update keeps the closest range of all threads
+  cv::Mat dst = cv::Mat::zeros(pano.dbuf.size(), pano.dbuf.type());
+  BitMask dst_mask(dst.rows, dst.cols);
+  constexpr int kCnt = 8;
+  for (int t = 0; t < kNumThreads; ++t) {
+    threads.emplace_back([&pano, &dst, &dst_mask, t]() {
+      // Far to near, so that threads keep replacing each other
+      for (int k = kNumRounds - 1; k >= 0; --k) {
+        const float rg = 2.0F + (k * kNumThreads + t) / DepthPixel::kScale;
+        for (int r = 0; r < dst.rows; ++r) {
+          for (int c = 0; c < dst.cols; ++c) {
+            pano.UpdateBuffer(dst, dst_mask, {c, r}, rg, kCnt);
+          }
+        }
+      }
+    });
+  }
+  for (auto& th : threads) th.join();
+
+  EXPECT_EQ(dst_mask.Count(), num_pixels);
+  for (int r = 0; r < dst.rows; ++r) {
+    for (int c = 0; c < dst.cols; ++c) {
+      const auto& pixel = dst.at<DepthPixel>(r, c);
+      ASSERT_EQ(pixel.GetRange(), 2.0F);
+      ASSERT_EQ(pixel.cnt, kCnt / 2);
+    }
+  }
+}
+
 void BM_PanoAddSweep(benchmark::State& state) {
   DepthPano pano({1024, 256});
   const auto sweep = MakeTestSweep({1024, 64});
@@ -29,9 +205,36 @@ void BM_PanoAddSweep(benchmark::State& state) {
 }
 BENCHMARK(BM_PanoAddSweep)->Arg(0)->Arg(1)->Arg(2)->Arg(4);
 
+void BM_PanoAddChunk(benchmark::State& state) {
+  // Low latency mode, each chunk is added to sweep then ejected to pano
+  const cv::Size size{1024, 64};
+  const int num_chunks = state.range(0);
+  const int width = size.width / num_chunks;
+  DepthPano pano({1024, 256});
+  LidarSweep sweep(size);
+  const auto full = MakeTestScan(size);
+
+  std::vector<LidarScan> chunks;
+  for (int c0 = 0; c0 < size.width; c0 += width) {
+    const cv::Range curr{c0, c0 + width};
+    chunks.emplace_back(
+        full.time, full.dt, full.scale, full.mat.colRange(curr), curr);
+  }
+
+  for (auto _ : state) {
+    for (const auto& chunk : chunks) {
+      sweep.Add(chunk);
+      pano.Add(sweep, chunk.curr, 0);
+    }
+    benchmark::DoNotOptimize(pano);
+  }
+}
+BENCHMARK(BM_PanoAddChunk)->Arg(1)->Arg(4)->Arg(16);
+
 void BM_PanoRender(benchmark::State& state) {
   DepthPano pano({1024, 256});
   pano.dbuf.setTo(1024);
+  pano.UpdateMask();
   const int gsize = state.range(0);
 
   for (auto _ : state) {
@@ -41,5 +244,28 @@ void BM_PanoRender(benchmark::State& state) {
 }
 BENCHMARK(BM_PanoRender)->Arg(0)->Arg(1)->Arg(2)->Arg(4);
 
+void BM_PanoRenderSparse(benchmark::State& state) {
+  // Only every n-th row has depth, like a pano with a few sweeps added
+  DepthPano pano({1024, 256});
+  pano.dbuf.setTo(0);
+  const int step = state.range(0);
+  for (int r = 0; r < pano.rows(); r += step) {
+    pano.dbuf.row(r).setTo(cv::Scalar(1024, 10));
+  }
+  pano.UpdateMask();
+  const cv::Mat dbuf0 = pano.dbuf.clone();
+  const auto mask0 = pano.mask;
+
+  for (auto _ : state) {
+    state.PauseTiming();
+    dbuf0.copyTo(pano.dbuf);
+    pano.mask = mask0;
+    state.ResumeTiming();
+    pano.Render({}, 0);
+    benchmark::DoNotOptimize(pano);
+  }
+}
+BENCHMARK(BM_PanoRenderSparse)->Arg(1)->Arg(4)->Arg(16);
+
 }  // namespace
 }  // namespace sv
@@ -0,0 +1,283 @@
+#include "sv/llol/record.h"
+
+#include <fcntl.h>
+#include <glog/logging.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+
+namespace sv {
+
+namespace {
+
+// Bump the version whenever the layout of a record changes
+constexpr char kMagic[8] = {'L', 'L', 'O', 'L', 'R', 'E', 'C', '2'};
+constexpr size_t kFileHeaderSize = 16;
+
+template <typename T>
+T ReadPod(const Record& record, RecordType type) {
+  CHECK(record.type == type) << "Record type mismatch";
+  CHECK_GE(record.size, sizeof(T)) << "Record too small";
+  T pod;
+  std::memcpy(&pod, record.data, sizeof(T));
+  return pod;
+}
+
+}  // namespace
+
+InitRecord Record::ToInit() const {
+  return ReadPod<InitRecord>(*this, RecordType::kInit);
+}
+
+ImuData Record::ToImu() const {
+  const auto rec = ReadPod<ImuRecord>(*this, RecordType::kImu);
+  ImuData imu;
+  imu.time = rec.time;
+  imu.acc = Eigen::Map<const Eigen::Vector3d>(rec.acc);
+  imu.gyr = Eigen::Map<const Eigen::Vector3d>(rec.gyr);
+  return imu;
+}
+
+LidarScan Record::ToScan() const {
+  const auto rec = ReadPod<ScanRecord>(*this, RecordType::kScan);
+  const size_t num_bytes = size_t(rec.rows) * rec.cols * sizeof(ScanPixel);
+  CHECK_GE(size, sizeof(ScanRecord) + num_bytes) << "Scan record too small";
+
+  // Pixels directly follow the record and are 16 byte aligned
+  auto* pixels = const_cast<uint8_t*>(data + sizeof(ScanRecord));
+  const cv::Mat mat(rec.rows, rec.cols, LidarScan::kDtype, pixels);
+  return {rec.time, rec.dt, rec.scale, mat, {rec.start, rec.end}};
+}
+
+/// ============================================================================
+RecordWriter::RecordWriter(const std::string& file)
+    : ofs_{file, std::ios::binary | std::ios::trunc} {
+  CHECK(ofs_.good()) << "Failed to open record file: " << file;
+  const char reserved[kFileHeaderSize - sizeof(kMagic)]{};
+  ofs_.write(kMagic, sizeof(kMagic));
+  ofs_.write(reserved, sizeof(reserved));
+}
+
+void RecordWriter::WriteHeader(RecordType type, uint32_t size) {
+  CHECK_EQ(size % 16, 0) << "Record size must be multiple of 16";
+  RecordHeader header;
+  header.type = static_cast<uint32_t>(type);
+  header.size = size;
+  ofs_.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  ++num_records_;
+}
+
+void RecordWriter::WriteInit(const InitRecord& init) {
+  WriteHeader(RecordType::kInit, sizeof(init));
+  ofs_.write(reinterpret_cast<const char*>(&init), sizeof(init));
+  ofs_.flush();
+}
+
+void RecordWriter::Write(const ImuData& imu) {
+  ImuRecord rec;
+  rec.time = imu.time;
+  Eigen::Map<Eigen::Vector3d>(rec.acc) = imu.acc;
+  Eigen::Map<Eigen::Vector3d>(rec.gyr) = imu.gyr;
+
+  WriteHeader(RecordType::kImu, sizeof(rec));
+  ofs_.write(reinterpret_cast<const char*>(&rec), sizeof(rec));
+}
+
+void RecordWriter::Write(const LidarScan& scan) {
+  CHECK_EQ(scan.type(), LidarScan::kDtype);
+
+  ScanRecord rec;
+  rec.time = scan.time;
+  rec.dt = scan.dt;
+  rec.scale = scan.scale;
+  rec.start = scan.curr.start;
+  rec.end = scan.curr.end;
+  rec.rows = scan.rows();
+  rec.cols = scan.cols();
+
+  // Scan could be a view of sweep, so write row by row
+  const size_t row_bytes = scan.cols() * sizeof(ScanPixel);
+  WriteHeader(RecordType::kScan, sizeof(rec) + row_bytes * scan.rows());
+  ofs_.write(reinterpret_cast<const char*>(&rec), sizeof(rec));
+  for (int r = 0; r < scan.rows(); ++r) {
+    ofs_.write(reinterpret_cast<const char*>(scan.mat.ptr(r)), row_bytes);
+  }
+}
+
+/// ============================================================================
+RecordReader::RecordReader(const std::string& file) {
+  const int fd = open(file.c_str(), O_RDONLY);
+  CHECK_GE(fd, 0) << "Failed to open record file: " << file;
+
+  struct stat st {};
+  CHECK_EQ(fstat(fd, &st), 0) << "Failed to stat record file: " << file;
+  size_ = st.st_size;
+  CHECK_GE(size_, kFileHeaderSize) << "Record file too small: " << file;
+
+  // Private writable mapping so that scans could be wrapped by cv::Mat, any
+  // write is copy-on-write and never reaches the file
+  void* ptr = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  CHECK(ptr != MAP_FAILED) << "Failed to mmap record file: " << file;
+
+  data_ = static_cast<uint8_t*>(ptr);
+  CHECK_EQ(std::memcmp(data_, kMagic, sizeof(kMagic) - 1), 0)
+      << "Not a record file: " << file;
+  CHECK_EQ(data_[sizeof(kMagic) - 1], kMagic[sizeof(kMagic) - 1])
+      << "Record file version mismatch, please record again: " << file;
+  Rewind();
+}
+
+RecordReader::~RecordReader() noexcept {
+  if (data_ != nullptr) munmap(data_, size_);
+}
+
+bool RecordReader::Next(Record& record) {
+  if (pos_ + sizeof(RecordHeader) > size_) return false;
+
+  RecordHeader header;
+  std::memcpy(&header, data_ + pos_, sizeof(header));
+  if (pos_ + sizeof(header) + header.size > size_) {
+    // Recording could be interrupted in the middle of a record
+    LOG(WARNING) << "Truncated record at " << pos_ << "/" << size_;
+    pos_ = size_;
+    return false;
+  }
+
+  record.type = static_cast<RecordType>(header.type);
+  record.data = data_ + pos_ + sizeof(header);
+  record.size = header.size;
+  pos_ += sizeof(header) + header.size;
+  return true;
+}
+
+void RecordReader::Rewind() noexcept { pos_ = kFileHeaderSize; }
+
+bool RecordReader::Find(RecordType type, Record& record) {
+  Rewind();
+  bool found = false;
+  while (Next(record)) {
+    if (record.type == type) {
+      found = true;
+      break;
+    }
+  }
+  Rewind();
+  return found;
+}
+
+InitRecord MakeInitRecord(const cv::Size& sweep_size,
+                          const EngineParams& params,
+                          const ImuQueue& imuq,
+                          const Sophus::SE3d& T_imu_lidar) {
+  InitRecord init;
+  init.sweep_rows = sweep_size.height;
+  init.sweep_cols = sweep_size.width;
+  init.pano_rows = params.pano_size.height;
+  init.pano_cols = params.pano_size.width;
+  init.imu_buffer = imuq.capacity();
+  Eigen::Map<Eigen::Vector4d>(init.q_imu_lidar) =
+      T_imu_lidar.unit_quaternion().coeffs();
+  Eigen::Map<Eigen::Vector3d>(init.t_imu_lidar) = T_imu_lidar.translation();
+  Eigen::Map<ImuNoise::Vector12d>(init.imu_noise) = imuq.noise.sigma2;
+  Eigen::Map<Eigen::Vector3d>(init.imu_acc_var) = imuq.bias.acc_var;
+  Eigen::Map<Eigen::Vector3d>(init.imu_gyr_var) = imuq.bias.gyr_var;
+
+  const auto& gp = params.grid;
+  init.grid_cell_rows = gp.cell_rows;
+  init.grid_cell_cols = gp.cell_cols;
+  init.grid_nms = gp.nms;
+  init.grid_destaggered = gp.destaggered;
+  init.grid_max_curve = gp.max_curve;
+  init.grid_max_var = gp.max_var;
+
+  const auto& tp = params.traj;
+  init.traj_use_acc = tp.use_acc;
+  init.traj_update_bias = tp.update_bias;
+  init.traj_gravity_norm = tp.gravity_norm;
+
+  const auto& cp = params.gicp;
+  init.gicp_outer = cp.outer;
+  init.gicp_inner = cp.inner;
+  init.gicp_half_rows = cp.half_rows;
+  init.gicp_half_cols = cp.half_cols;
+  init.gicp_cov_lambda = cp.cov_lambda;
+  init.gicp_imu_weight = cp.imu_weight;
+  init.gicp_min_eigval = cp.min_eigval;
+
+  const auto& pp = params.pano;
+  CHECK_LE(pp.beams.size(), InitRecord::kMaxBeams) << "Too many beams";
+  init.pano_vfov = pp.vfov;
+  init.pano_min_range = pp.min_range;
+  init.pano_max_range = pp.max_range;
+  init.pano_win_ratio = pp.win_ratio;
+  init.pano_fuse_ratio = pp.fuse_ratio;
+  init.pano_max_cnt = pp.max_cnt;
+  init.pano_min_sweeps = pp.min_sweeps;
+  init.pano_align_gravity = pp.align_gravity;
+  init.pano_async_render = pp.async_render;
+  init.pano_ray_table = pp.ray_table;
+  init.pano_min_match_ratio = pp.min_match_ratio;
+  init.pano_max_translation = pp.max_translation;
+  init.pano_render_ahead = pp.render_ahead;
+  init.num_beams = static_cast<int32_t>(pp.beams.size());
+  std::copy(pp.beams.begin(), pp.beams.end(), init.pano_beams);
+  return init;
+}
+
+Sophus::SE3d GetTfImuLidar(const InitRecord& init) {
+  Eigen::Quaterniond q;
+  q.coeffs() = Eigen::Map<const Eigen::Vector4d>(init.q_imu_lidar);
+  const Eigen::Vector3d t = Eigen::Map<const Eigen::Vector3d>(init.t_imu_lidar);
+  return {q, t};
+}
+
+EngineParams GetEngineParams(const InitRecord& init) {
+  EngineParams params;
+  params.pano_size = {init.pano_cols, init.pano_rows};
+
+  auto& gp = params.grid;
+  gp.cell_rows = init.grid_cell_rows;
+  gp.cell_cols = init.grid_cell_cols;
+  gp.nms = init.grid_nms;
+  gp.destaggered = init.grid_destaggered;
+  gp.max_curve = init.grid_max_curve;
+  gp.max_var = init.grid_max_var;
+
+  auto& tp = params.traj;
+  tp.use_acc = init.traj_use_acc;
+  tp.update_bias = init.traj_update_bias;
+  tp.gravity_norm = init.traj_gravity_norm;
+
+  auto& cp = params.gicp;
+  cp.outer = init.gicp_outer;
+  cp.inner = init.gicp_inner;
+  cp.half_rows = init.gicp_half_rows;
+  cp.half_cols = init.gicp_half_cols;
+  cp.cov_lambda = init.gicp_cov_lambda;
+  cp.imu_weight = init.gicp_imu_weight;
+  cp.min_eigval = init.gicp_min_eigval;
+
+  auto& pp = params.pano;
+  CHECK_LE(init.num_beams, InitRecord::kMaxBeams) << "Bad init record";
+  pp.vfov = init.pano_vfov;
+  pp.min_range = init.pano_min_range;
+  pp.max_range = init.pano_max_range;
+  pp.win_ratio = init.pano_win_ratio;
+  pp.fuse_ratio = init.pano_fuse_ratio;
+  pp.max_cnt = init.pano_max_cnt;
+  pp.min_sweeps = init.pano_min_sweeps;
+  pp.align_gravity = init.pano_align_gravity;
+  pp.async_render = init.pano_async_render;
+  pp.ray_table = init.pano_ray_table;
+  pp.min_match_ratio = init.pano_min_match_ratio;
+  pp.max_translation = init.pano_max_translation;
+  pp.render_ahead = init.pano_render_ahead;
+  pp.beams.assign(init.pano_beams, init.pano_beams + init.num_beams);
+  return params;
+}
+
+}  // namespace sv
@@ -0,0 +1,180 @@
+#pragma once
+
+#include <fstream>
+
+#include "sv/llol/gicp.h"
+#include "sv/llol/grid.h"
+#include "sv/llol/imu.h"
+#include "sv/llol/pano.h"
+#include "sv/llol/scan.h"
+#include "sv/llol/traj.h"
+
+namespace sv {
+
+/// Binary record of imus and scans for offline replay. The file starts with a
+/// 16 byte file header, followed by records that each consist of a 16 byte
+/// RecordHeader and a payload padded to 16 bytes. Scan pixels follow the
+/// ScanRecord directly, so a memory mapped file can be used without copy.
+enum class RecordType : uint32_t { kInit = 1, kImu = 2, kScan = 3 };
+
+struct RecordHeader {
+  uint32_t type{};     // RecordType
+  uint32_t size{};     // bytes of payload, multiple of 16
+  uint64_t reserved{};
+};
+static_assert(sizeof(RecordHeader) == 16, "Size of RecordHeader must be 16");
+
+/// @struct Params of the engine parts as configured by the node, the init
+/// record keeps them so that replay runs with the same config
+struct EngineParams {
+  cv::Size pano_size{1024, 256};
+  PanoParams pano;
+  GridParams grid;
+  TrajectoryParams traj;
+  GicpParams gicp;
+};
+
+/// @struct Everything needed to initialize the engine the same way as the
+/// recording node, written once extrinsics are known. Bools are stored as
+/// int32 so that the layout does not depend on the compiler.
+struct InitRecord {
+  static constexpr int kMaxBeams = 128;
+
+  int32_t sweep_rows{};
+  int32_t sweep_cols{};
+  int32_t pano_rows{};
+  int32_t pano_cols{};
+  int32_t imu_buffer{};
+  int32_t num_beams{};                 // number of valid pano_beams
+  double q_imu_lidar[4]{};             // qx qy qz qw
+  double t_imu_lidar[3]{};             // tx ty tz
+  double imu_noise[ImuNoise::kDim]{};  // ImuNoise::sigma2
+  double imu_acc_var[3]{};             // ImuBias::acc_var
+  double imu_gyr_var[3]{};             // ImuBias::gyr_var
+
+  /// GridParams
+  int32_t grid_cell_rows{};
+  int32_t grid_cell_cols{};
+  int32_t grid_nms{};
+  int32_t grid_destaggered{};
+  float grid_max_curve{};
+  float grid_max_var{};
+
+  /// TrajectoryParams
+  int32_t traj_use_acc{};
+  int32_t traj_update_bias{};
+  double traj_gravity_norm{};
+
+  /// GicpParams
+  int32_t gicp_outer{};
+  int32_t gicp_inner{};
+  int32_t gicp_half_rows{};
+  int32_t gicp_half_cols{};
+  float gicp_cov_lambda{};
+  int32_t gicp_reserved{};
+  double gicp_imu_weight{};
+  double gicp_min_eigval{};
+
+  /// PanoParams
+  float pano_vfov{};
+  float pano_min_range{};
+  float pano_max_range{};
+  float pano_win_ratio{};
+  float pano_fuse_ratio{};
+  int32_t pano_max_cnt{};
+  int32_t pano_min_sweeps{};
+  int32_t pano_align_gravity{};
+  int32_t pano_async_render{};
+  int32_t pano_ray_table{};
+  double pano_min_match_ratio{};
+  double pano_max_translation{};
+  double pano_render_ahead{};
+  float pano_beams[kMaxBeams]{};  // [rad]
+};
+static_assert(sizeof(InitRecord) % 16 == 0, "InitRecord must be 16 aligned");
+
+struct ImuRecord {
+  double time{};
+  double acc[3]{};
+  double gyr[3]{};
+  double reserved{};
+};
+static_assert(sizeof(ImuRecord) % 16 == 0, "ImuRecord must be 16 aligned");
+
+/// @struct Followed by rows x cols ScanPixels
+struct ScanRecord {
+  double time{};
+  double dt{};
+  double scale{};
+  int32_t start{};
+  int32_t end{};
+  int32_t rows{};
+  int32_t cols{};
+  double reserved{};
+};
+static_assert(sizeof(ScanRecord) % 16 == 0, "ScanRecord must be 16 aligned");
+
+/// @brief A view of a record in a memory mapped file
+struct Record {
+  RecordType type{};
+  const uint8_t* data{nullptr};  // payload
+  uint32_t size{};               // bytes of payload
+
+  /// @brief Decode payload, scan mat points into the mapped file (no copy)
+  /// and must not be modified
+  InitRecord ToInit() const;
+  ImuData ToImu() const;
+  LidarScan ToScan() const;
+};
+
+/// @class Append imus and scans to a record file
+class RecordWriter {
+ public:
+  explicit RecordWriter(const std::string& file);
+
+  void WriteInit(const InitRecord& init);
+  void Write(const ImuData& imu);
+  void Write(const LidarScan& scan);
+
+  int num_records() const noexcept { return num_records_; }
+
+ private:
+  void WriteHeader(RecordType type, uint32_t size);
+
+  std::ofstream ofs_;
+  int num_records_{0};
+};
+
+/// @class Read records from a memory mapped file
+class RecordReader {
+ public:
+  explicit RecordReader(const std::string& file);
+  ~RecordReader() noexcept;
+
+  RecordReader(const RecordReader&) = delete;
+  RecordReader& operator=(const RecordReader&) = delete;
+
+  /// @brief Get next record, return false at the end of file
+  bool Next(Record& record);
+  /// @brief Go back to the first record
+  void Rewind() noexcept;
+  /// @brief Find the first record of type, reader is rewound
+  bool Find(RecordType type, Record& record);
+
+  size_t size() const noexcept { return size_; }
+
+ private:
+  uint8_t* data_{nullptr};
+  size_t size_{};
+  size_t pos_{};
+};
+
+/// @brief Make InitRecord from current state and back
+InitRecord MakeInitRecord(const cv::Size& sweep_size,
+                          const EngineParams& params,
+                          const ImuQueue& imuq,
+                          const Sophus::SE3d& T_imu_lidar);
+Sophus::SE3d GetTfImuLidar(const InitRecord& init);
+EngineParams GetEngineParams(const InitRecord& init);
+
+}  // namespace sv
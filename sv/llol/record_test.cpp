@@ -0,0 +1,129 @@
+#include "sv/llol/record.h"
+
+#include <benchmark/benchmark.h>
+#include <gtest/gtest.h>
+
+#include <cstdio>
+
+namespace sv {
+namespace {
+
+const std::string kTestFile = "/tmp/llol_record_test.bin";
+
+TEST(RecordTest, TestWriteRead) {
+  ImuQueue imuq(16);
+  imuq.bias = {1e-2, 1e-3};
+  const Sophus::SE3d T_imu_lidar{Eigen::Quaterniond::Identity(),
+                                 Eigen::Vector3d{1, 2, 3}};
+  EngineParams params;
+  params.grid.cell_cols = 32;
+  params.grid.destaggered = true;
+  params.traj.gravity_norm = 9.8;
+  params.gicp.half_rows = 3;
+  params.pano.vfov = 0.5F;
+  params.pano.async_render = true;
+  params.pano.beams = {0.2F, 0.1F, -0.1F};
+  const auto init = MakeInitRecord({1024, 64}, params, imuq, T_imu_lidar);
+
+  ImuData imu;
+  imu.time = 1.0;
+  imu.acc = {1, 2, 3};
+  imu.gyr = {4, 5, 6};
+
+  // Scan is a view of a larger mat to test non-continuous write
+  const auto sweep = MakeTestScan({32, 8});
+  const cv::Range curr{8, 24};
+  const LidarScan scan(1.0, 0.1, 512.0, sweep.mat.colRange(curr), curr);
+
+  {
+    RecordWriter writer(kTestFile);
+    writer.Write(imu);
+    writer.WriteInit(init);
+    writer.Write(scan);
+    EXPECT_EQ(writer.num_records(), 3);
+  }
+
+  RecordReader reader(kTestFile);
+  Record record;
+  ASSERT_TRUE(reader.Find(RecordType::kInit, record));
+  const auto init1 = record.ToInit();
+  EXPECT_EQ(init1.sweep_cols, 1024);
+  EXPECT_EQ(init1.pano_rows, 256);
+  EXPECT_EQ(init1.imu_buffer, 16);
+  EXPECT_EQ(init1.t_imu_lidar[2], 3);
+  EXPECT_EQ(init1.q_imu_lidar[3], 1);
+  const auto T_imu_lidar1 = GetTfImuLidar(init1);
+  EXPECT_EQ(T_imu_lidar1.translation(), T_imu_lidar.translation());
+  EXPECT_EQ(Eigen::Map<const Eigen::Vector3d>(init1.imu_acc_var),
+            imuq.bias.acc_var);
+  EXPECT_EQ(Eigen::Map<const Eigen::Vector3d>(init1.imu_gyr_var),
+            imuq.bias.gyr_var);
+
+  // Params that are not set above keep their defaults
+  const auto params1 = GetEngineParams(init1);
+  EXPECT_EQ(params1.pano_size, params.pano_size);
+  EXPECT_EQ(params1.grid.cell_cols, 32);
+  EXPECT_EQ(params1.grid.cell_rows, GridParams{}.cell_rows);
+  EXPECT_TRUE(params1.grid.destaggered);
+  EXPECT_EQ(params1.grid.max_curve, GridParams{}.max_curve);
+  EXPECT_EQ(params1.traj.gravity_norm, 9.8);
+  EXPECT_EQ(params1.gicp.half_rows, 3);
+  EXPECT_EQ(params1.gicp.cov_lambda, GicpParams{}.cov_lambda);
+  EXPECT_EQ(params1.pano.vfov, 0.5F);
+  EXPECT_TRUE(params1.pano.async_render);
+  EXPECT_EQ(params1.pano.min_match_ratio, PanoParams{}.min_match_ratio);
+  EXPECT_EQ(params1.pano.beams, params.pano.beams);
+
+  ASSERT_TRUE(reader.Next(record));
+  ASSERT_EQ(record.type, RecordType::kImu);
+  const auto imu1 = record.ToImu();
+  EXPECT_EQ(imu1.time, imu.time);
+  EXPECT_EQ(imu1.acc, imu.acc);
+  EXPECT_EQ(imu1.gyr, imu.gyr);
+
+  ASSERT_TRUE(reader.Next(record));
+  ASSERT_EQ(record.type, RecordType::kInit);
+
+  ASSERT_TRUE(reader.Next(record));
+  ASSERT_EQ(record.type, RecordType::kScan);
+  const auto scan1 = record.ToScan();
+  EXPECT_EQ(scan1.time, scan.time);
+  EXPECT_EQ(scan1.curr, curr);
+  EXPECT_EQ(scan1.size(), scan.size());
+  // Scan points into the mapped file and is aligned
+  EXPECT_EQ(scan1.mat.data, record.data + sizeof(ScanRecord));
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(scan1.mat.data) % 16, 0);
+  for (int r = 0; r < scan.rows(); ++r) {
+    for (int c = 0; c < scan.cols(); ++c) {
+      const auto& px0 = scan.mat.at<ScanPixel>(r, c);
+      const auto& px1 = scan1.mat.at<ScanPixel>(r, c);
+      ASSERT_EQ(px0.x, px1.x);
+      ASSERT_EQ(px0.range_raw, px1.range_raw);
+    }
+  }
+
+  EXPECT_FALSE(reader.Next(record));
+  std::remove(kTestFile.c_str());
+}
+
+void BM_RecordRead(benchmark::State& state) {
+  const auto scan = MakeTestScan({1024, 64});
+  {
+    RecordWriter writer(kTestFile);
+    for (int i = 0; i < 100; ++i) writer.Write(scan);
+  }
+
+  RecordReader reader(kTestFile);
+  Record record;
+  for (auto _ : state) {
+    reader.Rewind();
+    while (reader.Next(record)) {
+      benchmark::DoNotOptimize(record.ToScan());
+    }
+  }
+  std::remove(kTestFile.c_str());
+}
+BENCHMARK(BM_RecordRead);
+
+}  // namespace
+}  // namespace sv
@@ -0,0 +1,95 @@
+#include <glog/logging.h>
+
+#include "sv/llol/engine.h"
+#include "sv/llol/record.h"
+#include "sv/util/timer.h"
+
+namespace sv {
+
+/// @brief Initialize engine with the same sizes and params as the recording
+/// node
+void InitEngine(const InitRecord& init, OdomEngine& engine) {
+  const auto params = GetEngineParams(init);
+  engine.imuq = ImuQueue{init.imu_buffer};
+  engine.imuq.noise.sigma2 =
+      Eigen::Map<const ImuNoise::Vector12d>(init.imu_noise);
+  engine.imuq.bias.acc_var =
+      Eigen::Map<const Eigen::Vector3d>(init.imu_acc_var);
+  engine.imuq.bias.gyr_var =
+      Eigen::Map<const Eigen::Vector3d>(init.imu_gyr_var);
+  engine.pano = DepthPano{params.pano_size, params.pano};
+  engine.InitLidar({init.sweep_cols, init.sweep_rows},
+                   params.grid,
+                   params.traj,
+                   params.gicp);
+  LOG(INFO) << engine.sweep;
+  LOG(INFO) << engine.grid;
+  LOG(INFO) << engine.traj;
+  LOG(INFO) << engine.gicp;
+  LOG(INFO) << engine.pano;
+}
+
+void Replay(const std::string& file, int gsize) {
+  RecordReader reader(file);
+
+  Record record;
+  CHECK(reader.Find(RecordType::kInit, record))
+      << "No init record found in " << file;
+  const auto init = record.ToInit();
+
+  OdomEngine engine;
+  engine.gsize = gsize;
+  InitEngine(init, engine);
+
+  int num_imus = 0;
+  int num_scans = 0;
+  int num_icp_ok = 0;
+  engine.output_cb = [&](const OdomOutput& output) {
+    num_icp_ok += output.icp_ok;
+  };
+
+  Timer timer;
+  while (reader.Next(record)) {
+    switch (record.type) {
+      case RecordType::kInit: {
+        CHECK(engine.InitExtrinsics(GetTfImuLidar(init))) << "Imu queue not full";
+        LOG(INFO) << engine.traj;
+        break;
+      }
+      case RecordType::kImu:
+        engine.AddImu(record.ToImu());
+        ++num_imus;
+        break;
+      case RecordType::kScan:
+        // Scans recorded before extrinsics are known are skipped as in node
+        if (!engine.Ready()) break;
+        engine.AddScan(record.ToScan());
+        ++num_scans;
+        break;
+      default:
+        LOG(WARNING) << "Unknown record type: "
+                     << static_cast<int>(record.type);
+    }
+  }
+  timer.Stop();
+
+  const auto elapsed = absl::Nanoseconds(timer.Elapsed());
+  LOG(INFO) << engine.tm.ReportAll(true);
+  LOG(INFO) << engine.sm.ReportAll(true);
+  LOG(INFO) << "Replayed " << num_scans << " scans (" << num_icp_ok
+            << " icp ok) and " << num_imus << " imus in " << elapsed
+            << ", scan rate: "
+            << num_scans / absl::ToDoubleSeconds(elapsed) << " Hz";
+}
+
+}  // namespace sv
+
+int main(int argc, char** argv) {
+  google::InitGoogleLogging(argv[0]);
+  FLAGS_logtostderr = true;
+
+  CHECK_GE(argc, 2) << "Usage: " << argv[0] << " <record> [tbb_grainsize]";
+  const int gsize = argc > 2 ? std::stoi(argv[2]) : 0;
+  sv::Replay(argv[1], gsize);
+  return 0;
+}
@@ -6,8 +6,196 @@
 
 #include <opencv2/core.hpp>
 
+#if defined(__x86_64__) || defined(__i386__)
+#define SV_SCAN_X86
+#include <immintrin.h>
+#endif
+
 namespace sv {
 
+Isa BestIsa() {
+#ifdef SV_SCAN_X86
+  static const Isa isa = [] {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return Isa::kAvx2;
+    if (__builtin_cpu_supports("sse4.1")) return Isa::kSse4;
+    return Isa::kScalar;
+  }();
+  return isa;
+#else
+  return Isa::kScalar;
+#endif
+}
+
+namespace {
+
+/// Score from sum and squared sum of n ranges, same as CalcScore()
+cv::Vec2f MakeScore(float sum, float sq_sum, int n, float mid) {
+  // Discard if there are fewer than 8 points
+  if (n < 8) return {kNaNF, kNaNF};
+  cv::Vec2f score;
+  score[0] = std::abs(sum / mid / n - 1.0F);
+  score[1] = 1.0 / (n * (n - 1)) * (n * sq_sum - sum * sum) / mid;
+  return score;
+}
+
+/// Range of the middle pixel of a cell, 0 means cell is invalid
+float CellMid(const ScanPixel* pcell, int width, double scale) {
+  const int half = width / 2;
+  return std::min<float>(pcell[half - 1].range_raw / scale,
+                         pcell[half].range_raw / scale);
+}
+
+int ScoreRowScalar(const ScanPixel* prow,
+                   size_t stride,
+                   const cv::Size& cell,
+                   int num_cells,
+                   double scale,
+                   cv::Vec2f* scores) {
+  int num_valid = 0;
+  for (int i = 0; i < num_cells; ++i) {
+    const auto* pcell = prow + i * cell.width;
+    const auto mid = CellMid(pcell, cell.width, scale);
+    if (mid == 0) {
+      scores[i] = {kNaNF, kNaNF};
+      continue;
+    }
+
+    int n = 0;
+    float sum = 0.0F;
+    float sq_sum = 0.0F;
+    for (int r = 0; r < cell.height; ++r) {
+      const auto* pr = pcell + r * stride;
+      for (int c = 0; c < cell.width; ++c) {
+        // Invalid pixel adds 0, so result is the same as skipping it
+        const bool ok = pr[c].Ok();
+        const float rg = ok ? pr[c].range_raw / scale : 0.0F;
+        sum += rg;
+        sq_sum += rg * rg;
+        n += ok;
+      }
+    }
+
+    scores[i] = MakeScore(sum, sq_sum, n, mid);
+    num_valid += !std::isnan(scores[i][0]);
+  }
+  return num_valid;
+}
+
+#ifdef SV_SCAN_X86
+
+/// Pixel at lo in the low half and pixel at hi in the high half
+__attribute__((target("avx2"))) inline __m256 LoadPixels(const float* lo,
+                                                         const float* hi) {
+  return _mm256_insertf128_ps(
+      _mm256_castps128_ps256(_mm_loadu_ps(lo)), _mm_loadu_ps(hi), 1);
+}
+
+/// Same pixel of 8 cells that are step floats apart starting at p, lane k is
+/// cell k. Loads whole pixels of cell k and k + 4 into the halves of a
+/// register, then deinterleaves x (for validity) and range_raw with shuffles.
+__attribute__((target("avx2"))) inline void LoadCells(const float* p,
+                                                      int step,
+                                                      __m256& x,
+                                                      __m256& raw) {
+  const __m256 a = LoadPixels(p, p + 4 * step);             // 0 | 4
+  const __m256 b = LoadPixels(p + step, p + 5 * step);      // 1 | 5
+  const __m256 d = LoadPixels(p + 2 * step, p + 6 * step);  // 2 | 6
+  const __m256 e = LoadPixels(p + 3 * step, p + 7 * step);  // 3 | 7
+  // x0 w0 x1 w1 | x4 w4 x5 w5 and x2 w2 x3 w3 | x6 w6 x7 w7
+  const __m256 t0 = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(3, 0, 3, 0));
+  const __m256 t1 = _mm256_shuffle_ps(d, e, _MM_SHUFFLE(3, 0, 3, 0));
+  x = _mm256_shuffle_ps(t0, t1, _MM_SHUFFLE(2, 0, 2, 0));
+  const __m256 w = _mm256_shuffle_ps(t0, t1, _MM_SHUFFLE(3, 1, 3, 1));
+  raw = _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_castps_si256(w),
+                                            _mm256_set1_epi32(0xFFFF)));
+}
+
+/// 8 cells at a time, one cell per lane. Each step loads the same pixel of 8
+/// neighboring cells, so sums need no horizontal reduction and the score
+/// itself is also computed in lanes. Cells left over at the end of the row go
+/// to the scalar kernel. Summation order is the same as scalar, but the score
+/// is computed in float, so results could differ in the last bits.
+__attribute__((target("avx2"))) int ScoreRowAvx2(const ScanPixel* prow,
+                                                 size_t stride,
+                                                 const cv::Size& cell,
+                                                 int num_cells,
+                                                 double scale,
+                                                 cv::Vec2f* scores) {
+  const __m256 vscale = _mm256_set1_ps(static_cast<float>(scale));
+  const __m256 one = _mm256_set1_ps(1.0F);
+  const __m256 nan = _mm256_set1_ps(kNaNF);
+  const __m256 abs_mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7FFFFFFF));
+  const __m256i min_n = _mm256_set1_epi32(8);
+  const int step = cell.width * 4;  // in floats
+
+  const int half = cell.width / 2;
+  int num_valid = 0;
+  int i = 0;
+  for (; i + 8 <= num_cells; i += 8) {
+    const auto* pcells = reinterpret_cast<const float*>(prow + i * cell.width);
+
+    // Same as CellMid(), which ignores validity of the middle pixels
+    __m256 x;
+    __m256 raw_l;
+    __m256 raw_r;
+    LoadCells(pcells + (half - 1) * 4, step, x, raw_l);
+    LoadCells(pcells + half * 4, step, x, raw_r);
+    const __m256 mid = _mm256_min_ps(_mm256_div_ps(raw_l, vscale),
+                                     _mm256_div_ps(raw_r, vscale));
+
+    __m256 vsum = _mm256_setzero_ps();
+    __m256 vsq_sum = _mm256_setzero_ps();
+    __m256i vn = _mm256_setzero_si256();
+    for (int r = 0; r < cell.height; ++r) {
+      const auto* pr = pcells + r * stride * 4;
+      for (int c = 0; c < cell.width; ++c) {
+        __m256 raw;
+        LoadCells(pr + c * 4, step, x, raw);
+        const __m256 valid = _mm256_cmp_ps(x, x, _CMP_ORD_Q);
+        const __m256 rg = _mm256_and_ps(_mm256_div_ps(raw, vscale), valid);
+        vsum = _mm256_add_ps(vsum, rg);
+        vsq_sum = _mm256_add_ps(vsq_sum, _mm256_mul_ps(rg, rg));
+        // valid lanes are all ones, which is -1
+        vn = _mm256_sub_epi32(vn, _mm256_castps_si256(valid));
+      }
+    }
+
+    // Same as MakeScore() in each lane
+    const __m256 n = _mm256_cvtepi32_ps(vn);
+    const __m256 s0 = _mm256_and_ps(
+        _mm256_sub_ps(_mm256_div_ps(_mm256_div_ps(vsum, mid), n), one),
+        abs_mask);
+    const __m256 var = _mm256_sub_ps(_mm256_mul_ps(n, vsq_sum),
+                                     _mm256_mul_ps(vsum, vsum));
+    const __m256 s1 = _mm256_div_ps(
+        _mm256_div_ps(var, _mm256_mul_ps(n, _mm256_sub_ps(n, one))), mid);
+    const __m256 bad = _mm256_or_ps(
+        _mm256_cmp_ps(mid, _mm256_setzero_ps(), _CMP_EQ_OQ),
+        _mm256_castsi256_ps(_mm256_cmpgt_epi32(min_n, vn)));
+
+    alignas(32) float s0s[8];
+    alignas(32) float s1s[8];
+    _mm256_store_ps(s0s, _mm256_blendv_ps(s0, nan, bad));
+    _mm256_store_ps(s1s, _mm256_blendv_ps(s1, nan, bad));
+    for (int k = 0; k < 8; ++k) {
+      scores[i + k] = {s0s[k], s1s[k]};
+    }
+    num_valid += 8 - __builtin_popcount(_mm256_movemask_ps(bad));
+  }
+
+  return num_valid + ScoreRowScalar(prow + i * cell.width,
+                                    stride,
+                                    cell,
+                                    num_cells - i,
+                                    scale,
+                                    scores + i);
+}
+
+#endif
+
+}  // namespace
+
 /// ScanBase ===================================================================
 ScanBase::ScanBase(const cv::Size& size, int dtype) : mat{size, dtype} {
   tfs.resize(size.width);
@@ -35,7 +223,8 @@ void ScanBase::UpdateTime(double new_time, double new_dt) {
 
 cv::Mat ScanBase::ExtractRange() const {
   static cv::Mat range;
-  cv::Mat image(size(), CV_16UC(8), mat.data);
+  // mat may be a view into a wider sweep, so keep its row step
+  cv::Mat image(size(), CV_16UC(8), mat.data, mat.step);
   cv::extractChannel(image, range, 6);
   return range;
 }
@@ -65,14 +254,18 @@ LidarScan::LidarScan(double time,
 void LidarScan::CalcMeanCovar(const cv::Rect& rect, MeanCovar3f& mc) const {
   mc.Reset();
 
-  // NOTE (chao): for now only take first row of cell due to staggered scan
-  for (int c = 0; c < rect.width; ++c) {
-    const auto& xyzr = PixelAt({rect.x + c, rect.y});
-    if (xyzr.Ok()) mc.Add(xyzr.Vec3fMap());
+  // Only a destaggered scan should pass a rect with more than one row
+  for (int r = 0; r < rect.height; ++r) {
+    for (int c = 0; c < rect.width; ++c) {
+      const auto& xyzr = PixelAt({rect.x + c, rect.y + r});
+      if (xyzr.Ok()) mc.Add(xyzr.Vec3fMap());
+    }
   }
 }
 
-cv::Vec2f LidarScan::CalcScore(const cv::Point& px, int width) const {
+cv::Vec2f LidarScan::CalcScore(const cv::Point& px,
+                               int width,
+                               int height) const {
   cv::Vec2f score(kNaNF, kNaNF);
 
   // compute sum of range in cell
@@ -86,14 +279,16 @@ cv::Vec2f LidarScan::CalcScore(const cv::Point& px, int width) const {
   const auto mid = std::min(left, right);
   if (mid == 0) return score;
 
-  for (int c = 0; c < width; ++c) {
-    const auto& pixel = PixelAt({px.x + c, px.y});
-    if (!pixel.Ok()) continue;
-    const float rg = pixel.range_raw / scale;
+  for (int r = 0; r < height; ++r) {
+    for (int c = 0; c < width; ++c) {
+      const auto& pixel = PixelAt({px.x + c, px.y + r});
+      if (!pixel.Ok()) continue;
+      const float rg = pixel.range_raw / scale;
 
-    sum += rg;
-    sq_sum += rg * rg;
-    ++n;
+      sum += rg;
+      sq_sum += rg * rg;
+      ++n;
+    }
   }
 
   // Discard if there are fewer than 8 points
@@ -106,6 +301,25 @@ cv::Vec2f LidarScan::CalcScore(const cv::Point& px, int width) const {
   return score;
 }
 
+int LidarScan::CalcScoreRow(int r,
+                            const cv::Size& cell,
+                            cv::Vec2f* scores,
+                            Isa isa) const {
+  CHECK_EQ(type(), kDtype);
+  CHECK_EQ(cols() % cell.width, 0);
+  CHECK_LE(r + cell.height, rows());
+  const auto* prow = mat.ptr<ScanPixel>(r);
+  const size_t stride = mat.step / sizeof(ScanPixel);  // in pixels
+  const int num_cells = cols() / cell.width;
+
+#ifdef SV_SCAN_X86
+  if (isa == Isa::kAvx2) {
+    return ScoreRowAvx2(prow, stride, cell, num_cells, scale, scores);
+  }
+#endif
+  return ScoreRowScalar(prow, stride, cell, num_cells, scale, scores);
+}
+
 /// Test Related ===============================================================
 cv::Mat MakeTestMat(const cv::Size& size) {
   cv::Mat xyzr = cv::Mat::zeros(size, LidarScan::kDtype);
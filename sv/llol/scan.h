@@ -7,6 +7,11 @@
 
 namespace sv {
 
+/// @brief Instruction set used by simd kernels
+enum class Isa { kScalar, kSse4, kAvx2 };
+/// @brief Best instruction set supported by this cpu (runtime check)
+Isa BestIsa();
+
 struct ScanBase {
   // start and delta time
   double time{};  // time of the last column
@@ -80,8 +85,16 @@ struct LidarScan : public ScanBase {
     return PixelAt(px).range_raw / scale;
   }
 
-  /// @brief Calculate smoothness and variance score of a cell starting at px
-  cv::Vec2f CalcScore(const cv::Point& px, int width) const;
+  /// @brief Calculate smoothness and variance score of a cell starting at px,
+  /// height > 1 only makes sense for a destaggered scan
+  cv::Vec2f CalcScore(const cv::Point& px, int width, int height = 1) const;
+  /// @brief Same as CalcScore() for every cell starting at row r in one pass
+  /// @param scores has cols() / cell.width elements
+  /// @return Number of valid scores
+  int CalcScoreRow(int r,
+                   const cv::Size& cell,
+                   cv::Vec2f* scores,
+                   Isa isa) const;
   /// @brief Calculate mean and covar of a cell in rect
   void CalcMeanCovar(const cv::Rect& rect, MeanCovar3f& mc) const;
 };
@@ -3,13 +3,35 @@
 //#define FMT_HEADER_ONLY
 #include <fmt/core.h>
 #include <glog/logging.h>
-#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_reduce.h>
 #include <opencv2/core.hpp>
 
 #include "sv/util/ocv.h"
 
 namespace sv {
 
+namespace {
+
+/// Count valid pixels (non-zero range) of each column of AoS scan, and set
+/// bits of its columns in mask, which start at col c0, in the same pass
+void CountCols(const cv::Mat& mat, int c0, BitMask& mask, int* cnt) {
+  for (int r = 0; r < mat.rows; ++r) {
+    const auto* prow = mat.ptr<ScanPixel>(r);
+    for (int c = 0; c < mat.cols; ++c) {
+      cnt[c] += prow[c].range_raw > 0;
+      mask.Set(r, c0 + c, prow[c].Ok());
+    }
+  }
+}
+
+}  // namespace
+
+LidarSweep::LidarSweep(const cv::Size& size)
+    : LidarScan{size},
+      col_valid(size.width, 0),
+      mask{size.height, size.width} {}
+
 int LidarSweep::Add(const LidarScan& scan) {
   CHECK_EQ(scan.type(), type());
   CHECK_EQ(scan.rows(), rows());
@@ -19,42 +41,67 @@ int LidarSweep::Add(const LidarScan& scan) {
   UpdateView(scan.curr);
   scale = scan.scale;
 
-  // copy to storage
-  scan.mat.copyTo(mat.colRange(curr));  // x,y,w,h
-  return cv::countNonZero(ExtractRange());
+  // copy to storage, unless scan was already written in place
+  cv::Mat dst = mat.colRange(curr);  // x,y,w,h
+  if (scan.mat.data != dst.data) scan.mat.copyTo(dst);
+
+  // count valid pixels and update mask of curr only
+  int* cnt = col_valid.data() + curr.start;
+  for (int c = curr.start; c < curr.end; ++c) num_valid -= col_valid[c];
+  std::fill(cnt, cnt + curr.size(), 0);
+  CountCols(dst, curr.start, mask, cnt);
+  for (int c = curr.start; c < curr.end; ++c) num_valid += col_valid[c];
+  return num_valid;
 }
 
 void LidarSweep::Interp(const Trajectory& traj, int gsize) {
+  SetTraj(traj);
+  InterpRange({0, cols()}, gsize);
+}
+
+void LidarSweep::SetTraj(const Trajectory& traj) {
   const int num_cells = traj.size() - 1;
-  const int cell_width = cols() / num_cells;
-  const auto grid_end = curr.end / cell_width;
+  CHECK_GT(num_cells, 0);
+  CHECK_EQ(cols() % num_cells, 0);
+
+  knots_ = traj.states;
+  T_imu_lidar_ = traj.T_imu_lidar;
+  cell_width_ = cols() / num_cells;
+  grid_end_ = curr.end / cell_width_;
+  stale_.assign(num_cells, 1);
+}
+
+int LidarSweep::InterpRange(const cv::Range& range, int gsize) {
+  if (stale_.empty() || range.empty()) return 0;
+
+  const int num_cells = stale_.size();
+  const int gc0 = range.start / cell_width_;
+  const int gc1 = (range.end - 1) / cell_width_ + 1;
   gsize = gsize <= 0 ? num_cells : gsize;
 
-  tbb::parallel_for(
-      tbb::blocked_range<int>(0, num_cells, gsize), [&](const auto& blk) {
+  return tbb::parallel_reduce(
+      tbb::blocked_range<int>(gc0, gc1, gsize),
+      0,
+      [&](const auto& blk, int n) {
         for (int gc = blk.begin(); gc < blk.end(); ++gc) {
+          if (!stale_[gc]) continue;
+
           // Note that the starting point of traj is where curr
           // ends, so we need to offset by curr.end to find the
           // corresponding traj segment
-
-          const int tc = WrapCols(gc - grid_end, num_cells);
-          const auto& st0 = traj.At(tc);
-          const auto& st1 = traj.At(tc + 1);
-
-          const auto dr = (st0.rot.inverse() * st1.rot).log();
-          const auto dp = (st1.pos - st0.pos).eval();
-
-          for (int j = 0; j < cell_width; ++j) {
-            // which column
-            const int col = gc * cell_width + j;
-            const float s = static_cast<float>(j) / cell_width;
-            Sophus::SE3d tf_p_i;
-            tf_p_i.so3() = st0.rot * Sophus::SO3d::exp(s * dr);
-            tf_p_i.translation() = st0.pos + s * dp;
-            tfs.at(col) = (tf_p_i * traj.T_imu_lidar).cast<float>();
-          }
+          const int tc = WrapCols(gc - grid_end_, num_cells);
+          const int col0 = gc * cell_width_;
+          InterpSegment(knots_.at(tc),
+                        knots_.at(tc + 1),
+                        T_imu_lidar_,
+                        cell_width_,
+                        &tfs.at(col0));
+          stale_[gc] = 0;
+          ++n;
         }
-      });
+        return n;
+      },
+      std::plus<>{});
 }
 
 std::string LidarSweep::Repr() const {
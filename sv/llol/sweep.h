@@ -2,25 +2,57 @@
 
 #include "sv/llol/scan.h"
 #include "sv/llol/traj.h"
+#include "sv/util/bitmask.h"
 
 namespace sv {
 
 /// @struct Lidar Sweep is a Lidar Scan that covers 360 degree hfov
 struct LidarSweep final : public LidarScan {
+  /// Number of valid pixels in each col, updated when scan is added
+  std::vector<int> col_valid;
+  int num_valid{};  // sum of col_valid
+  /// Bit is set if pixel in mat is Ok(), updated when scan is added
+  BitMask mask;
+
   LidarSweep() = default;
-  explicit LidarSweep(const cv::Size& size) : LidarScan{size} {}
+  explicit LidarSweep(const cv::Size& size);
 
   std::string Repr() const;
   friend std::ostream& operator<<(std::ostream& os, const LidarSweep& rhs) {
     return os << rhs.Repr();
   }
 
-  /// @brief Add a scan to this sweep
-  /// @return Number of points added
+  /// @brief Storage of cols in curr, write incoming scan here (see Add)
+  cv::Mat Slot(const cv::Range& curr) const { return mat.colRange(curr); }
+
+  /// @brief Add a scan to this sweep, scan could also be a view of this sweep
+  /// (e.g. Slot()) in which case nothing is copied. Valid points are counted
+  /// while ingesting curr instead of scanning the whole sweep.
+  /// @return Number of valid points in sweep
   int Add(const LidarScan& scan);
 
   /// @brief Interpolate pose of each column
   void Interp(const Trajectory& traj, int gsize = 0);
+  /// @brief Keep traj to interpolate poses on demand, poses of all columns are
+  /// stale until they are covered by InterpRange()
+  void SetTraj(const Trajectory& traj);
+  /// @brief Interpolate poses of stale columns in cols from the kept traj
+  /// @return Number of cells interpolated
+  int InterpRange(const cv::Range& cols, int gsize = 0);
+  /// @brief Whether pose of column col is up to date, TfAt() of a stale col
+  /// returns the pose of the previous traj
+  bool TfOk(int col) const {
+    return stale_.empty() || !stale_[col / cell_width_];
+  }
+
+ private:
+  /// Segment states of the last traj, curr.end in grid when it was set, and
+  /// whether poses of each cell are stale
+  std::vector<NavState> knots_;
+  Sophus::SE3d T_imu_lidar_;
+  int grid_end_{};
+  int cell_width_{1};
+  std::vector<uint8_t> stale_;
 };
 
 LidarSweep MakeTestSweep(const cv::Size& size);
@@ -3,6 +3,8 @@
 #include <benchmark/benchmark.h>
 #include <gtest/gtest.h>
 
+#include <opencv2/core.hpp>
+
 namespace sv {
 namespace {
 
@@ -47,6 +49,114 @@ TEST(ScanTest, TestAdd) {
   std::cout << ls << "\n";
 }
 
+TEST(ScanTest, TestAddInPlace) {
+  LidarSweep ls({8, 4});
+  // Write scan directly into sweep storage
+  const cv::Range curr{4, 8};
+  MakeTestScan({4, 4}).mat.copyTo(ls.mat.colRange(curr));
+  const LidarScan scan{1.0, 0.1, 512.0, ls.mat.colRange(curr), curr};
+  ls.curr = {0, 4};
+
+  ls.Add(scan);
+  EXPECT_EQ(ls.curr.start, 4);
+  EXPECT_EQ(ls.curr.end, 8);
+  EXPECT_EQ(ls.PixelAt({4, 0}).range_raw, 1024);
+}
+
+TEST(ScanTest, TestExtractRangeView) {
+  // Scan viewing part of the sweep extracts only its own columns
+  LidarSweep ls({8, 4});
+  for (int r = 0; r < ls.rows(); ++r) {
+    for (int c = 0; c < ls.cols(); ++c) {
+      ls.mat.at<ScanPixel>(r, c).range_raw = r * ls.cols() + c;
+    }
+  }
+
+  const cv::Range curr{4, 8};
+  const LidarScan scan{1.0, 0.1, 512.0, ls.mat.colRange(curr), curr};
+  const auto range = scan.ExtractRange();
+  ASSERT_EQ(range.size(), scan.size());
+  for (int r = 0; r < scan.rows(); ++r) {
+    for (int c = 0; c < scan.cols(); ++c) {
+      EXPECT_EQ(range.at<uint16_t>(r, c), scan.PixelAt({c, r}).range_raw);
+    }
+  }
+}
+
+TEST(ScanTest, TestNumValid) {
+  // Valid count from ingestion matches a full recount of the sweep
+  LidarSweep ls({8, 4});
+  EXPECT_EQ(ls.num_valid, 0);
+
+  LidarScan scan = MakeTestScan({4, 4});
+  scan.curr = {0, 4};
+  EXPECT_EQ(ls.Add(scan), 16);
+
+  auto& pixel = scan.mat.at<ScanPixel>(1, 2);
+  pixel.x = kNaNF;
+  pixel.range_raw = 0;
+  scan.curr = {4, 8};
+  EXPECT_EQ(ls.Add(scan), 31);
+  EXPECT_EQ(ls.num_valid, cv::countNonZero(ls.ExtractRange()));
+
+  // Overwrite first half with the invalid pixel as well
+  scan.curr = {0, 4};
+  EXPECT_EQ(ls.Add(scan), 30);
+  EXPECT_EQ(ls.num_valid, cv::countNonZero(ls.ExtractRange()));
+  EXPECT_EQ(ls.col_valid.at(2), 3);
+
+  // Mask is updated in the same pass
+  EXPECT_FALSE(ls.mask.Test(1, 2));
+  EXPECT_FALSE(ls.mask.Test(1, 6));
+  EXPECT_TRUE(ls.mask.Test(1, 3));
+  EXPECT_EQ(ls.mask.Count(), ls.num_valid);
+}
+
+TEST(ScanTest, TestInterpRange) {
+  Trajectory traj(65);
+  for (int i = 0; i < traj.size(); ++i) {
+    traj.At(i).rot = Sophus::SO3d::exp({0.01 * i, 0.02, -0.01 * i});
+    traj.At(i).pos = {0.1 * i, -0.05 * i, 0.2};
+  }
+
+  LidarSweep sweep0({1024, 64});
+  sweep0.Interp(traj);
+
+  // Lazy sweep only interpolates cells covering the given cols
+  LidarSweep sweep1({1024, 64});
+  sweep1.SetTraj(traj);
+  EXPECT_FALSE(sweep1.TfOk(0));
+  EXPECT_EQ(sweep1.InterpRange({20, 40}), 2);
+  EXPECT_EQ(sweep1.InterpRange({16, 64}), 1);
+  EXPECT_FALSE(sweep1.TfOk(15));
+  EXPECT_FALSE(sweep1.TfOk(64));
+
+  for (int c = 16; c < 64; ++c) {
+    ASSERT_TRUE(sweep1.TfOk(c));
+    const auto& tf0 = sweep0.TfAt(c);
+    const auto& tf1 = sweep1.TfAt(c);
+    EXPECT_EQ(tf0.translation(), tf1.translation());
+    EXPECT_EQ(tf0.unit_quaternion().coeffs(), tf1.unit_quaternion().coeffs());
+  }
+
+  EXPECT_EQ(sweep1.InterpRange({0, 1024}), 61);
+  EXPECT_TRUE(sweep1.TfOk(1023));
+}
+
+void BM_SweepInterpRange(benchmark::State& state) {
+  // Chunked mode only needs poses of one chunk per scan
+  LidarSweep sweep({1024, 64});
+  Trajectory traj(65);
+  const int width = 1024 / state.range(0);
+
+  for (auto _ : state) {
+    sweep.SetTraj(traj);
+    sweep.InterpRange({0, width});
+    benchmark::DoNotOptimize(sweep);
+  }
+}
+BENCHMARK(BM_SweepInterpRange)->Arg(1)->Arg(4)->Arg(16);
+
 void BM_SweepAdd(benchmark::State& state) {
   const cv::Size size{1024, 64};
   LidarSweep sweep(size);
@@ -59,9 +169,23 @@ void BM_SweepAdd(benchmark::State& state) {
 }
 BENCHMARK(BM_SweepAdd);
 
+void BM_SweepAddInPlace(benchmark::State& state) {
+  const cv::Size size{1024, 64};
+  LidarSweep sweep(size);
+  const cv::Range curr{0, size.width};
+  MakeTestScan(size).mat.copyTo(sweep.Slot(curr));
+  const LidarScan scan{1.0, 0.1, 512.0, sweep.Slot(curr), curr};
+
+  for (auto _ : state) {
+    auto n = sweep.Add(scan);
+    benchmark::DoNotOptimize(n);
+  }
+}
+BENCHMARK(BM_SweepAddInPlace);
+
 void BM_SweepInterp(benchmark::State& state) {
   LidarSweep sweep({1024, 64});
-  Trajectory traj(64);
+  Trajectory traj(65);
   int gsize = state.range(0);
 
   for (auto _ : state) {
@@ -260,4 +260,44 @@ SE3d Trajectory::TfPanoLidar() const {
 
 SE3d Trajectory::TfOdomLidar() const { return T_odom_pano * TfPanoLidar(); }
 
+void InterpSegment(const NavState& st0,
+                   const NavState& st1,
+                   const SE3d& T_imu_lidar,
+                   int n,
+                   Sophus::SE3f* tfs) {
+  const Quaterniond& q_il = T_imu_lidar.unit_quaternion();
+  const Vector3d& t_il = T_imu_lidar.translation();
+
+  // R(s) = R0 * exp(s * dr) = R0 * exp(dr / n)^i
+  const auto dr = (st0.rot.inverse() * st1.rot).log();
+  const Quaterniond dq = SO3d::exp(dr / n).unit_quaternion();
+  const Vector3d dp = (st1.pos - st0.pos) / n;
+
+  Quaterniond q = st0.rot.unit_quaternion();
+  Vector3d p = st0.pos;
+  for (int i = 0; i < n; ++i) {
+    const Quaterniond q_pl = q * q_il;
+    const Vector3d t_pl = q * t_il + p;
+    tfs[i] = Sophus::SE3f{Sophus::SO3f{q_pl.cast<float>()}, t_pl.cast<float>()};
+    q *= dq;
+    p += dp;
+  }
+}
+
+Sophus::SE3f InterpMid(const NavState& st0,
+                       const NavState& st1,
+                       const SE3d& T_imu_lidar) {
+  // Slerp at 0.5 is the normalized sum of the two quaternions on the same
+  // hemisphere
+  const auto& q0 = st0.rot.unit_quaternion();
+  const auto& q1 = st1.rot.unit_quaternion();
+  Quaterniond q;
+  q.coeffs() = q0.dot(q1) < 0 ? (q0.coeffs() - q1.coeffs()).eval()
+                              : (q0.coeffs() + q1.coeffs()).eval();
+  q.normalize();
+
+  const SE3d tf_p_i{q, (st0.pos + st1.pos) / 2.0};
+  return (tf_p_i * T_imu_lidar).cast<float>();
+}
+
 }  // namespace sv
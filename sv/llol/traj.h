@@ -65,4 +65,18 @@ struct Trajectory {
   Matrix6d cov{Matrix6d::Zero()};
 };
 
+/// @brief Interpolate n poses between st0 and st1 at s = i / n, i in [0, n),
+/// and compose each with T_imu_lidar. Rotation is advanced by a constant step
+/// exp(log(R0^T R1) / n), so only one exp is needed per segment.
+void InterpSegment(const NavState& st0,
+                   const NavState& st1,
+                   const Sophus::SE3d& T_imu_lidar,
+                   int n,
+                   Sophus::SE3f* tfs);
+
+/// @brief Same as InterpSegment() at s = 0.5, without exp or log
+Sophus::SE3f InterpMid(const NavState& st0,
+                       const NavState& st1,
+                       const Sophus::SE3d& T_imu_lidar);
+
 }  // namespace sv
@@ -2,6 +2,8 @@
 
 #include <gtest/gtest.h>
 
+#include <sophus/interpolate.hpp>
+
 namespace sv {
 namespace {
 
@@ -21,5 +23,54 @@ TEST(TrajTest, TestPredict) {
   EXPECT_EQ(traj.back().time, 3.5);
 }
 
+NavState MakeState(const Eigen::Vector3d& w, const Eigen::Vector3d& p) {
+  NavState st;
+  st.rot = Sophus::SO3d::exp(w);
+  st.pos = p;
+  return st;
+}
+
+TEST(TrajTest, TestInterpSegment) {
+  const auto st0 = MakeState({0.1, -0.2, 0.3}, {1, 2, 3});
+  const auto st1 = MakeState({0.15, -0.1, 0.35}, {1.1, 2.2, 2.9});
+  const Sophus::SE3d T_i_l{Sophus::SO3d::exp({0.0, 0.0, 3.0}), {0, 0, 0.1}};
+
+  const int n = 32;
+  std::vector<Sophus::SE3f> tfs(n);
+  InterpSegment(st0, st1, T_i_l, n, tfs.data());
+
+  // Same as interpolating each column independently
+  const auto dr = (st0.rot.inverse() * st1.rot).log();
+  for (int i = 0; i < n; ++i) {
+    const double s = static_cast<double>(i) / n;
+    Sophus::SE3d tf_p_i;
+    tf_p_i.so3() = st0.rot * Sophus::SO3d::exp(s * dr);
+    tf_p_i.translation() = st0.pos + s * (st1.pos - st0.pos);
+    const Sophus::SE3f expected = (tf_p_i * T_i_l).cast<float>();
+
+    EXPECT_LT((expected.so3().inverse() * tfs[i].so3()).log().norm(), 1e-6);
+    EXPECT_LT((expected.translation() - tfs[i].translation()).norm(), 1e-5);
+  }
+}
+
+TEST(TrajTest, TestInterpMid) {
+  const auto st0 = MakeState({0.1, -0.2, 0.3}, {1, 2, 3});
+  const Sophus::SE3d T_i_l{Sophus::SO3d::exp({0.0, 0.0, 3.0}), {0, 0, 0.1}};
+
+  // Also across the quaternion sign flip
+  for (const auto& st1 : {MakeState({0.15, -0.1, 0.35}, {1.1, 2.2, 2.9}),
+                          MakeState({3.0, 0.0, 0.0}, {0, 0, 0})}) {
+    const auto tf = InterpMid(st0, st1, T_i_l);
+
+    Sophus::SE3d tf_p_i;
+    tf_p_i.so3() = Sophus::interpolate(st0.rot, st1.rot, 0.5);
+    tf_p_i.translation() = (st0.pos + st1.pos) / 2.0;
+    const Sophus::SE3f expected = (tf_p_i * T_i_l).cast<float>();
+
+    EXPECT_LT((expected.so3().inverse() * tf.so3()).log().norm(), 1e-6);
+    EXPECT_LT((expected.translation() - tf.translation()).norm(), 1e-5);
+  }
+}
+
 }  // namespace
 }  // namespace sv
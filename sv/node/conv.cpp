@@ -1,6 +1,7 @@
 #include "sv/node/conv.h"
 
 #include <cv_bridge/cv_bridge.h>
+#include <glog/logging.h>
 #include <tf2_eigen/tf2_eigen.h>
 
 namespace sv {
@@ -35,67 +36,164 @@ ImuData MakeImu(const sensor_msgs::Imu& imu_msg) {
 }
 
 LidarScan MakeScan(const sensor_msgs::Image& image_msg,
-                   const sensor_msgs::CameraInfo& cinfo_msg) {
-  cv_bridge::CvImageConstPtr cv_ptr;
-  cv_ptr = cv_bridge::toCvCopy(image_msg, "32FC4");
-
-  return {image_msg.header.stamp.toSec(),    // t
-          cinfo_msg.K[0],                    // dt
-          cinfo_msg.R[0],                    // scale
-          cv_ptr->image,                     // xyzr
-          cv::Range(cinfo_msg.roi.x_offset,  // col_rg
-                    cinfo_msg.roi.x_offset + cinfo_msg.roi.width)};
+                   const sensor_msgs::CameraInfo& cinfo_msg,
+                   const cv::Mat& storage) {
+  const cv::Range curr(cinfo_msg.roi.x_offset,
+                       cinfo_msg.roi.x_offset + cinfo_msg.roi.width);
+  CHECK_LE(curr.end, storage.cols);
+
+  // Share the message data (only converts if encoding differs) and copy it
+  // once into storage, the message outlives this call
+  const auto cv_ptr = cv_bridge::toCvShare(image_msg, nullptr, "32FC4");
+  CHECK_EQ(cv_ptr->image.rows, storage.rows);
+  CHECK_EQ(cv_ptr->image.cols, curr.size());
+  cv::Mat mat = storage.colRange(curr);
+  cv_ptr->image.copyTo(mat);
+
+  return {image_msg.header.stamp.toSec(),  // t
+          cinfo_msg.K[0],                  // dt
+          cinfo_msg.R[0],                  // scale
+          mat,                             // xyzr
+          curr};                           // col_rg
 }
 
-LidarSweep MakeSweep(const sensor_msgs::CameraInfo& cinfo_msg) {
-  return LidarSweep{cv::Size(cinfo_msg.width, cinfo_msg.height)};
+/// Ouster cloud related constants
+static constexpr double kCloudRate = 20.0;
+
+LidarScan MakeScan(const sensor_msgs::PointCloud2& cloud_msg,
+                   const ros::Time& stamp,
+                   const Destagger& destagger,
+                   const cv::Mat& storage,
+                   const cv::Range& curr,
+                   int gsize) {
+  const cv::Size size(cloud_msg.width, cloud_msg.height);
+  CHECK_EQ(destagger.rows(), size.height) << "Destagger and cloud mismatch";
+  CHECK_EQ(destagger.cols(), size.width) << "Destagger and cloud mismatch";
+  CHECK_LE(curr.end, size.width);
+
+  int offset_reflectivity = 0;
+  for (const auto& field : cloud_msg.fields) {
+    if (field.name == "reflectivity") offset_reflectivity = field.offset;
+  }
+
+  cv::Mat mat = storage.colRange(curr);
+  destagger.Gather(cloud_msg.data.data(),
+                   cloud_msg.point_step,
+                   offset_reflectivity,
+                   curr,
+                   mat,
+                   gsize);
+
+  // stamp is the time of the last column of the cloud
+  const double dt = 1.0 / kCloudRate / size.width;
+  return {stamp.toSec() - dt * (size.width - curr.end),  // t
+          dt,                                            // dt
+          destagger.range_scale,                         // scale
+          mat,                                           // xyzr
+          curr};                                         // col_rg
 }
 
-SweepGrid InitGrid(const ros::NodeHandle& pnh, const cv::Size& sweep_size) {
-  GridParams gp;
-  gp.cell_rows = pnh.param<int>("cell_rows", gp.cell_rows);
-  gp.cell_cols = pnh.param<int>("cell_cols", gp.cell_cols);
-  gp.max_curve = pnh.param<double>("max_curve", gp.max_curve);
-  gp.max_var = pnh.param<double>("max_var", gp.max_var);
-  gp.nms = pnh.param<bool>("nms", gp.nms);
-  return SweepGrid{sweep_size, gp};
+ros::Time GetCloudStamp(const sensor_msgs::PointCloud2& cloud_msg,
+                        bool stamp_at_the_front) {
+  auto stamp = cloud_msg.header.stamp;
+  if (!stamp_at_the_front) return stamp;
+
+  int offset_time = -1;
+  for (const auto& field : cloud_msg.fields) {
+    if (field.name == "t") offset_time = field.offset;
+  }
+  if (offset_time < 0) return stamp;
+
+  // Use time of the last valid point
+  const int num_points = cloud_msg.width * cloud_msg.height;
+  for (int i = num_points - 1; i >= 0; --i) {
+    const auto t_ns = *reinterpret_cast<const uint32_t*>(
+        &cloud_msg.data[cloud_msg.point_step * i + offset_time]);
+    if (t_ns == 0) continue;
+    stamp += ros::Duration().fromNSec(t_ns);
+    break;
+  }
+  return stamp;
 }
 
-DepthPano InitPano(const ros::NodeHandle& pnh) {
-  PanoParams pp;
-  const auto pano_rows = pnh.param<int>("rows", 256);
-  const auto pano_cols = pnh.param<int>("cols", 1024);
-  pp.vfov = Deg2Rad(pnh.param<double>("vfov", pp.vfov));
-  pp.max_cnt = pnh.param<int>("max_cnt", pp.max_cnt);
-  pp.min_sweeps = pnh.param<int>("min_sweeps", pp.min_sweeps);
-  pp.min_range = pnh.param<double>("min_range", pp.min_range);
-  pp.max_range = pnh.param<double>("max_range", pp.max_range);
-  pp.win_ratio = pnh.param<double>("win_ratio", pp.win_ratio);
-  pp.fuse_ratio = pnh.param<double>("fuse_ratio", pp.fuse_ratio);
-  pp.align_gravity = pnh.param<bool>("align_gravity", pp.align_gravity);
-  pp.min_match_ratio = pnh.param<double>("min_match_ratio", pp.min_match_ratio);
-  pp.max_translation = pnh.param<double>("max_translation", pp.max_translation);
-  return DepthPano({pano_cols, pano_rows}, pp);
+EngineParams ReadEngineParams(const ros::NodeHandle& pnh) {
+  EngineParams params;
+
+  const ros::NodeHandle grid_nh{pnh, "grid"};
+  auto& gp = params.grid;
+  gp.cell_rows = grid_nh.param<int>("cell_rows", gp.cell_rows);
+  gp.cell_cols = grid_nh.param<int>("cell_cols", gp.cell_cols);
+  gp.max_curve = grid_nh.param<double>("max_curve", gp.max_curve);
+  gp.max_var = grid_nh.param<double>("max_var", gp.max_var);
+  gp.nms = grid_nh.param<bool>("nms", gp.nms);
+  gp.destaggered = grid_nh.param<bool>("destaggered", gp.destaggered);
+
+  const ros::NodeHandle pano_nh{pnh, "pano"};
+  auto& pp = params.pano;
+  params.pano_size.height = pano_nh.param<int>("rows", 256);
+  params.pano_size.width = pano_nh.param<int>("cols", 1024);
+  pp.vfov = Deg2Rad(pano_nh.param<double>("vfov", pp.vfov));
+  pp.max_cnt = pano_nh.param<int>("max_cnt", pp.max_cnt);
+  pp.min_sweeps = pano_nh.param<int>("min_sweeps", pp.min_sweeps);
+  pp.min_range = pano_nh.param<double>("min_range", pp.min_range);
+  pp.max_range = pano_nh.param<double>("max_range", pp.max_range);
+  pp.win_ratio = pano_nh.param<double>("win_ratio", pp.win_ratio);
+  pp.fuse_ratio = pano_nh.param<double>("fuse_ratio", pp.fuse_ratio);
+  pp.align_gravity = pano_nh.param<bool>("align_gravity", pp.align_gravity);
+  pp.min_match_ratio =
+      pano_nh.param<double>("min_match_ratio", pp.min_match_ratio);
+  pp.max_translation =
+      pano_nh.param<double>("max_translation", pp.max_translation);
+  pp.async_render = pano_nh.param<bool>("async_render", pp.async_render);
+  pp.render_ahead = pano_nh.param<double>("render_ahead", pp.render_ahead);
+  pp.ray_table = pano_nh.param<bool>("ray_table", pp.ray_table);
+  // Beam altitude angles of the sensor in degree, top to bottom
+  const auto beams = pano_nh.param<std::vector<double>>("beams", {});
+  for (const auto beam : beams) pp.beams.push_back(Deg2Rad(beam));
+
+  const ros::NodeHandle gicp_nh{pnh, "gicp"};
+  auto& cp = params.gicp;
+  cp.outer = gicp_nh.param<int>("outer", cp.outer);
+  cp.inner = gicp_nh.param<int>("inner", cp.inner);
+  cp.half_rows = gicp_nh.param<int>("half_rows", cp.half_rows);
+  cp.half_cols = gicp_nh.param<int>("half_cols", cp.half_cols);
+  cp.cov_lambda = gicp_nh.param<double>("cov_lambda", cp.cov_lambda);
+  cp.imu_weight = gicp_nh.param<double>("imu_weight", cp.imu_weight);
+  cp.min_eigval = gicp_nh.param<double>("min_eigval", cp.min_eigval);
+
+  const ros::NodeHandle traj_nh{pnh, "traj"};
+  auto& tp = params.traj;
+  tp.use_acc = traj_nh.param<bool>("use_acc", tp.use_acc);
+  tp.update_bias = traj_nh.param<bool>("update_bias", tp.update_bias);
+  tp.gravity_norm = traj_nh.param<double>("gravity_norm", tp.gravity_norm);
+
+  return params;
 }
 
-GicpSolver InitGicp(const ros::NodeHandle& pnh) {
-  GicpParams gp;
-  gp.outer = pnh.param<int>("outer", gp.outer);
-  gp.inner = pnh.param<int>("inner", gp.inner);
-  gp.half_rows = pnh.param<int>("half_rows", gp.half_rows);
-  gp.half_cols = pnh.param<int>("half_cols", gp.half_cols);
-  gp.cov_lambda = pnh.param<double>("cov_lambda", gp.cov_lambda);
-  gp.imu_weight = pnh.param<double>("imu_weight", gp.imu_weight);
-  gp.min_eigval = pnh.param<double>("min_eigval", gp.min_eigval);
-  return GicpSolver{gp};
-}
-
-Trajectory InitTraj(const ros::NodeHandle& pnh, int grid_cols) {
-  TrajectoryParams tp;
-  tp.use_acc = pnh.param<bool>("use_acc", tp.use_acc);
-  tp.update_bias = pnh.param<bool>("update_bias", tp.update_bias);
-  tp.gravity_norm = pnh.param<double>("gravity_norm", tp.gravity_norm);
-  return Trajectory{grid_cols + 1, tp};
+Destagger InitDestagger(const ros::NodeHandle& pnh,
+                        const cv::Size& size,
+                        bool row_major) {
+  DestaggerParams dp;
+  dp.row_major = row_major;
+  dp.col_offset = pnh.param<int>("col_offset", dp.col_offset);
+  dp.range_scale = pnh.param<double>("range_scale", dp.range_scale);
+  dp.max_range = pnh.param<double>("max_range", dp.max_range);
+
+  LidarMeta meta;
+  const auto metadata = pnh.param<std::string>("metadata", "");
+  if (metadata.empty()) {
+    ROS_WARN_STREAM("No lidar metadata, use hard-coded pixel shifts");
+    meta = MakeLegacyMeta(size);
+    // Offsets used with the hard-coded shifts
+    if (dp.col_offset < 0) dp.col_offset = size.height == 128 ? 33 : 15;
+  } else {
+    meta = ReadLidarMeta(metadata);
+  }
+  CHECK_EQ(meta.rows, size.height) << "Lidar metadata and cloud mismatch";
+  CHECK_EQ(meta.cols, size.width) << "Lidar metadata and cloud mismatch";
+  ROS_INFO_STREAM(meta);
+
+  return Destagger{meta, dp};
 }
 
 ImuQueue InitImuq(const ros::NodeHandle& pnh) {
@@ -6,11 +6,14 @@
 #include <sensor_msgs/CameraInfo.h>
 #include <sensor_msgs/Image.h>
 #include <sensor_msgs/Imu.h>
+#include <sensor_msgs/PointCloud2.h>
 
+#include "sv/llol/destagger.h"
 #include "sv/llol/gicp.h"
 #include "sv/llol/grid.h"
 #include "sv/llol/imu.h"
 #include "sv/llol/pano.h"
+#include "sv/llol/record.h"
 #include "sv/llol/scan.h"
 #include "sv/llol/traj.h"
 
@@ -23,14 +26,32 @@ void SO3dToMsg(const Sophus::SO3d& so3, geometry_msgs::Quaternion& q);
 
 /// @brief Factory methods
 ImuData MakeImu(const sensor_msgs::Imu& imu_msg);
+/// @brief Write image of columns roi into storage.colRange(roi), the image is
+/// read from the message without an intermediate copy. The returned scan is a
+/// view of storage.
 LidarScan MakeScan(const sensor_msgs::Image& image_msg,
-                   const sensor_msgs::CameraInfo& cinfo_msg);
-LidarSweep MakeSweep(const sensor_msgs::CameraInfo& cinfo_msg);
+                   const sensor_msgs::CameraInfo& cinfo_msg,
+                   const cv::Mat& storage);
+/// @brief Destagger columns curr of an organized ouster cloud and write
+/// ScanPixels directly into storage.colRange(curr), which is usually the sweep
+/// itself, so no intermediate image is needed. The returned scan is a view of
+/// storage. curr could be a chunk of the cloud, stamp is of the whole cloud.
+LidarScan MakeScan(const sensor_msgs::PointCloud2& cloud_msg,
+                   const ros::Time& stamp,
+                   const Destagger& destagger,
+                   const cv::Mat& storage,
+                   const cv::Range& curr,
+                   int gsize = 0);
+/// @brief Cloud stamp, optionally moved to the time of the last valid point
+ros::Time GetCloudStamp(const sensor_msgs::PointCloud2& cloud_msg,
+                        bool stamp_at_the_front);
 
 ImuQueue InitImuq(const ros::NodeHandle& pnh);
-Trajectory InitTraj(const ros::NodeHandle& pnh, int grid_cols);
-SweepGrid InitGrid(const ros::NodeHandle& pnh, const cv::Size& sweep_size);
-DepthPano InitPano(const ros::NodeHandle& pnh);
-GicpSolver InitGicp(const ros::NodeHandle& pnh);
+/// @brief Read params of grid, pano, gicp and traj from their namespaces under
+/// pnh, these are also kept by the init record for replay
+EngineParams ReadEngineParams(const ros::NodeHandle& pnh);
+Destagger InitDestagger(const ros::NodeHandle& pnh,
+                        const cv::Size& size,
+                        bool row_major);
 
 }  // namespace sv
@@ -5,6 +5,6 @@
 int main(int argc, char** argv) {
   ros::init(argc, argv, "llol_node");
   sv::OdomNode node(ros::NodeHandle("~"));
-  ros::spin();
+  node.Spin();
   return 0;
 }
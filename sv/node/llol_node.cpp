@@ -1,19 +1,52 @@
 #include "sv/node/llol_node.h"
-#include <absl/strings/match.h>
 
-#include "sv/node/viz.h"
+#include <glog/logging.h>
+#include <ros/spinner.h>
 
-#include <tbb/parallel_for.h>
+#include "sv/node/viz.h"
 
 namespace sv {
 
 static constexpr double kMaxRange = 32.0;
 
+/// @brief Copy of nh whose callbacks go to queue
+ros::NodeHandle WithQueue(const ros::NodeHandle& nh,
+                          ros::CallbackQueue* queue) {
+  ros::NodeHandle nh_q{nh};
+  nh_q.setCallbackQueue(queue);
+  return nh_q;
+}
+
+/// @brief Largest number of chunks no more than num_chunks, such that each
+/// chunk of width has whole cells
+int ValidChunks(int width, int cell_cols, int num_chunks) {
+  for (int n = num_chunks; n > 1; --n) {
+    if (width % (n * cell_cols) == 0) return n;
+  }
+  return 1;
+}
+
 OdomNode::OdomNode(const ros::NodeHandle& pnh)
-    : pnh_{pnh}, it_{pnh}, tf_listener_{tf_buffer_} {
-  sub_camera_ = it_.subscribeCamera("image", 8, &OdomNode::CameraCb, this);
-  sub_lidar_ = pnh_.subscribe("cloud", 8, &OdomNode::LidarCb, this);
-  sub_imu_ = pnh_.subscribe(
+    : pnh_{pnh},
+      imu_nh_{WithQueue(pnh, &imu_queue_)},
+      lidar_nh_{WithQueue(pnh, &lidar_queue_)},
+      it_{lidar_nh_},
+      tf_listener_{tf_buffer_} {
+  // A cloud is a full sweep, one that already waits behind another is late
+  // for odometry, so a deep queue only adds latency. Scans are partial sweeps
+  // from the driver and a dropped one leaves a gap in the sweep, so allow
+  // about a sweep worth of them to queue up.
+  const int cloud_queue = pnh_.param<int>("cloud_queue", 2);
+  const int scan_queue = pnh_.param<int>("scan_queue", 16);
+  ROS_INFO_STREAM("Queue size, cloud: " << cloud_queue
+                                        << ", scan: " << scan_queue);
+
+  // Imu has its own queue so that it is received while registration is busy
+  sub_camera_ =
+      it_.subscribeCamera("image", scan_queue, &OdomNode::CameraCb, this);
+  sub_lidar_ =
+      lidar_nh_.subscribe("cloud", cloud_queue, &OdomNode::LidarCb, this);
+  sub_imu_ = imu_nh_.subscribe(
       "imu", 100, &OdomNode::ImuCb, this, ros::TransportHints().tcpNoDelay());
 
   odom_frame_ = pnh_.param<std::string>("odom_frame", "odom");
@@ -28,7 +61,19 @@ OdomNode::OdomNode(const ros::NodeHandle& pnh)
   stamp_at_the_front_ = pnh_.param<bool>("stamp_at_the_front", false);
   ROS_INFO_STREAM("StampAtTheFront: " << (stamp_at_the_front_ ? "True" : "False"));
 
+  // Chunks only split a cloud that is already fully received, they give more
+  // pose updates per cloud but do not reduce latency. It is validated against
+  // cloud width in Initialize().
+  num_chunks_ = pnh_.param<int>("num_chunks", 1);
+  if (num_chunks_ < 1) {
+    ROS_ERROR_STREAM("num_chunks must be positive, got " << num_chunks_
+                                                          << ", use 1");
+    num_chunks_ = 1;
+  }
+  ROS_INFO_STREAM("Cloud chunks: " << num_chunks_);
+
   tbb_ = pnh_.param<int>("tbb", 0);
+  engine_.gsize = tbb_;
   ROS_INFO_STREAM("Tbb grainsize: " << tbb_);
 
   log_ = pnh_.param<int>("log", 0);
@@ -41,14 +86,37 @@ OdomNode::OdomNode(const ros::NodeHandle& pnh)
 
   path_dist_ = pnh_.param<double>("path_dist", 0.01);
 
-  imuq_ = InitImuq({pnh_, "imuq"});
-  ROS_INFO_STREAM(imuq_);
+  const auto record = pnh_.param<std::string>("record", "");
+  if (!record.empty()) {
+    recorder_.emplace(record);
+    ROS_INFO_STREAM("Recording to: " << record);
+  }
+
+  engine_.imuq = InitImuq({pnh_, "imuq"});
+  ROS_INFO_STREAM(engine_.imuq);
+
+  // Imus are received at full rate into a ring, and drained when processing
+  engine_.imu_ring = ImuRing{pnh_.param<int>("imu_ring", 1024)};
+  ROS_INFO_STREAM(engine_.imu_ring);
 
-  pano_ = InitPano({pnh_, "pano"});
-  ROS_INFO_STREAM(pano_);
+  params_ = ReadEngineParams(pnh_);
+  engine_.pano = DepthPano{params_.pano_size, params_.pano};
+  ROS_INFO_STREAM(engine_.pano);
+
+  engine_.output_cb = [this](const OdomOutput& output) { OutputCb(output); };
+}
+
+void OdomNode::Spin() {
+  // One thread each, callbacks within a queue are still serialized
+  ros::AsyncSpinner imu_spinner(1, &imu_queue_);
+  ros::AsyncSpinner lidar_spinner(1, &lidar_queue_);
+  imu_spinner.start();
+  lidar_spinner.start();
+  ros::waitForShutdown();
 }
 
 void OdomNode::ImuCb(const sensor_msgs::Imu& imu_msg) {
+  std::unique_lock lock{mtx_};
   if (imu_frame_.empty()) {
     std::string frame_id = imu_msg.header.frame_id;
     if ( !frame_id.empty() && frame_id[0] == '/' )
@@ -66,23 +134,26 @@ void OdomNode::ImuCb(const sensor_msgs::Imu& imu_msg) {
   prev_header = imu_msg.header;
 
   const auto imu = MakeImu(imu_msg);
-  imuq_.Add(imu);
+  if (recorder_) recorder_->Write(imu);
+  lock.unlock();
 
-  if (tf_init_) return;
-
-  if (lidar_frame_.empty()) {
-    ROS_WARN_STREAM("Lidar not initialized");
-    return;
+  // Only push here, imus are moved to imuq by the lidar thread
+  if (!engine_.PushImu(imu)) {
+    ROS_WARN_STREAM("Imu ring full, drop imu at " << imu.time);
   }
+}
 
-  if (!imuq_.full()) {
-//    ROS_WARN_STREAM(fmt::format(
-//        "Imu queue not full: {}/{}", imuq_.size(), imuq_.capacity()));
-    ROS_WARN_STREAM("Imu queue not full: " << imuq_.size() <<" / " << imuq_.capacity());
-    return;
+bool OdomNode::InitExtrinsics() {
+  if (engine_.tf_init()) return true;
+
+  if (!engine_.imuq.full()) {
+    ROS_WARN_STREAM("Imu queue not full: " << engine_.imuq.size() << " / "
+                                           << engine_.imuq.capacity());
+    return false;
   }
 
   // Get tf between imu and lidar and initialize gravity direction
+  std::scoped_lock lock{mtx_};
   try {
     const auto tf_i_l = tf_buffer_.lookupTransform(
         imu_frame_, lidar_frame_, ros::Time(0));
@@ -90,231 +161,119 @@ void OdomNode::ImuCb(const sensor_msgs::Imu& imu_msg) {
     const auto& t = tf_i_l.transform.translation;
     const auto& q = tf_i_l.transform.rotation;
     const Eigen::Vector3d t_i_l{t.x, t.y, t.z};
-//    const Eigen::Quaterniond q_i_l{q.w, q.x, q.y, q.z};
     const Eigen::Quaterniond q_i_l = tf_overwrite_ ?
          Eigen::Quaterniond(0, 1, -1, 0).normalized() :
          Eigen::Quaterniond(q.w, q.x, q.y, q.z);
 
-    // Just use current acc
-    ROS_INFO_STREAM("buffer size: " << imuq_.size());
-    const auto imu_mean = imuq_.CalcMean(10);
-    const auto& imu0 = imuq_.buf.front();
-
-    ROS_INFO_STREAM("acc_curr: " << imu.acc.transpose()
-                                 << ", norm: " << imu.acc.norm());
-    ROS_INFO_STREAM("acc_mean: " << imu_mean.acc.transpose()
-                                 << ", norm: " << imu_mean.acc.norm());
-
-    // Use the one that is closer to 9.8
+    ROS_INFO_STREAM("buffer size: " << engine_.imuq.size());
     const Sophus::SE3d T_i_l{q_i_l, t_i_l};
-    const auto curr_acc_norm = imu.acc.norm();
-    const auto mean_acc_norm = imu_mean.acc.norm();
-    const auto gnorm = traj_.gravity_norm;
-
-    if (gnorm > 0 &&
-        std::abs(curr_acc_norm - gnorm) < std::abs(mean_acc_norm - gnorm)) {
-      ROS_INFO_STREAM("Use curr acc as gravity");
-      traj_.Init(T_i_l, imu.acc);
-    } else {
-      ROS_INFO_STREAM("Use mean acc as gravity");
-      traj_.Init(T_i_l, imu_mean.acc);
-    }
+    engine_.InitExtrinsics(T_i_l);
+    ROS_INFO_STREAM(engine_.traj);
 
-    ROS_INFO_STREAM(traj_);
-    tf_init_ = true;
+    if (recorder_) {
+      recorder_->WriteInit(
+          MakeInitRecord(engine_.sweep.size(), params_, engine_.imuq, T_i_l));
+    }
   } catch (tf2::TransformException& ex) {
     ROS_WARN_STREAM(ex.what());
-    return;
+    return false;
   }
+  return true;
 }
 
-void OdomNode::Initialize(const sensor_msgs::CameraInfo& cinfo_msg) {
+void OdomNode::Initialize(const cv::Size& sweep_size) {
   ROS_INFO_STREAM("+++ Initializing");
-  sweep_ = MakeSweep(cinfo_msg);
-  ROS_INFO_STREAM(sweep_);
-
-  grid_ = InitGrid({pnh_, "grid"}, sweep_.size());
-  ROS_INFO_STREAM(grid_);
+  engine_.InitLidar(sweep_size, params_.grid, params_.traj, params_.gicp);
+  ROS_INFO_STREAM(engine_.sweep);
+  ROS_INFO_STREAM(engine_.grid);
+  ROS_INFO_STREAM(engine_.traj);
+  ROS_INFO_STREAM(engine_.gicp);
+
+  const int cell_cols = engine_.grid.cell_size.width;
+  const int num_chunks = ValidChunks(sweep_size.width, cell_cols, num_chunks_);
+  if (num_chunks != num_chunks_) {
+    ROS_ERROR_STREAM("num_chunks " << num_chunks_ << " does not split width "
+                                   << sweep_size.width << " into whole cells of "
+                                   << cell_cols << " cols, use " << num_chunks);
+    num_chunks_ = num_chunks;
+  }
+}
 
-  traj_ = InitTraj({pnh_, "traj"}, grid_.cols());
-  ROS_INFO_STREAM(traj_);
+bool OdomNode::CheckLidar(const std_msgs::Header& header,
+                          const cv::Size& size) {
+  static std_msgs::Header prev_header;
+  if (prev_header.seq > 0 && prev_header.seq + 1 != header.seq) {
+    ROS_ERROR_STREAM("Missing lidar data, prev: " << prev_header.seq
+                                                  << ", curr: " << header.seq);
+  }
+  prev_header = header;
 
-  gicp_ = InitGicp({pnh_, "gicp"});
-  ROS_INFO_STREAM(gicp_);
-}
+  if (lidar_frame_.empty()) {
+    lidar_frame_ = header.frame_id;
+    // Allocate storage for sweep, grid and matcher
+    Initialize(size);
+    ROS_INFO_STREAM("Lidar frame: " << lidar_frame_);
+    ROS_INFO_STREAM("Lidar initialized!");
+  }
 
-void OdomNode::LidarCb(const sensor_msgs::PointCloud2ConstPtr& cloud_msg) {
-    if ( !cloud_msg->is_dense ) return;
+  // Imus pushed by ImuCb are moved to imuq on this thread
+  engine_.SyncImus();
+  if (engine_.imuq.empty()) {
+    ROS_WARN_STREAM("Imu not received");
+    return false;
+  }
 
-    constexpr float freq = 20.f;
-    constexpr int range_scale = 512;
-    constexpr uint32_t pixel_step = sizeof(float)*4;
-    const uint32_t point_step = cloud_msg->point_step;
-    const size_t num_points = cloud_msg->width * cloud_msg->height;
+  if (!InitExtrinsics()) {
+    ROS_WARN_STREAM("Transform not initialized");
+    return false;
+  }
 
-    static sensor_msgs::CameraInfo::Ptr cinfo_msg = nullptr; ( new sensor_msgs::CameraInfo );
-    static sensor_msgs::Image::Ptr image_msg  = nullptr;
+  return true;
+}
 
-    static const uint32_t pixel_shift_by_row_os0_128[128] ={64,43,22,1,63,42,22,3,62,42,23,3,61,42,23,4,60,41,23,5,59,41,23,6,59,41,23,6,58,41,24,7,58,41,24,7,57,40,24,7,57,40,24,8,57,40,24,8,56,40,24,8,56,40,24,8,56,40,24,8,56,40,24,8,56,40,24,8,56,40,24,8,56,40,24,8,56,40,24,8,56,40,24,8,56,40,24,7,57,40,24,7,57,40,23,7,57,40,23,6,58,40,23,6,58,41,23,5,59,41,23,4,59,41,22,4,60,41,22,3,61,41,22,2,62,42,21,0};
-    static const uint32_t pixel_shift_by_row_os1_64[64] ={19,12,6,0,19,13,6,0,19,13,7,1,19,13,7,1,19,13,7,1,19,13,7,1,19,13,7,1,19,13,7,1,19,13,7,1,19,13,7,1,19,13,7,1,19,13,7,1,19,13,7,1,19,13,7,1,20,13,7,1,20,14,8,1};
-    if ( ! cinfo_msg  )
-    {
-        cinfo_msg = sensor_msgs::CameraInfo::Ptr( new sensor_msgs::CameraInfo );
-        image_msg = sensor_msgs::Image::Ptr( new sensor_msgs::Image );
-        cinfo_msg->width = cloud_msg->width;
-        cinfo_msg->height = cloud_msg->height;
-        cinfo_msg->K[0] = 1.0 / freq / cloud_msg->width; // dt
-        cinfo_msg->R[0] = range_scale; // range scale
-        cinfo_msg->binning_x = 0; // iscan;
-        cinfo_msg->binning_y = 0; // model.cols / cloud_msg->width;
-        cinfo_msg->roi.x_offset = 0; //iscan * cloud_msg->width;
-        cinfo_msg->roi.y_offset = 0;
-        cinfo_msg->roi.width = cloud_msg->width;
-        cinfo_msg->roi.height = cloud_msg->height;
-        cinfo_msg->roi.do_rectify = false;
-
-        image_msg->data.resize( num_points * pixel_step );
-        image_msg->step = cloud_msg->width * pixel_step;
-        image_msg->encoding = "32FC4";
-        image_msg->height = cloud_msg->height;
-        image_msg->width = cloud_msg->width;
-    }
+void OdomNode::LidarCb(const sensor_msgs::PointCloud2ConstPtr& cloud_msg) {
+  if (!cloud_msg->is_dense) return;
 
-    cinfo_msg->header = cloud_msg->header;
-    image_msg->header = cloud_msg->header;
+  std_msgs::Header header = cloud_msg->header;
+  if (!header.frame_id.empty() && header.frame_id[0] == '/')
+    header.frame_id.erase(0, 1);
 
-    std::string frame_id = cloud_msg->header.frame_id;
-    if ( !frame_id.empty() && frame_id[0] == '/' )
-      frame_id.erase(0,1);
-    cinfo_msg->header.frame_id = frame_id;
-    image_msg->header.frame_id = frame_id;
+  const cv::Size size(cloud_msg->width, cloud_msg->height);
+  if (destagger_.size() != size) {
+    destagger_ = InitDestagger({pnh_, "destagger"}, size, pc_row_major_);
+    ROS_INFO_STREAM(destagger_);
+  }
+  if (!CheckLidar(header, size)) return;
 
+  // Split cloud into chunks of columns, each is processed like a partial scan
+  // from the driver, so that we get a pose update per chunk. The cloud is
+  // already complete, so this does not reduce latency of the first chunk.
+  const int chunk_cols = size.width / num_chunks_;
+  const auto stamp = GetCloudStamp(*cloud_msg, stamp_at_the_front_);
 
-    constexpr uint32_t pixel_range_offset = sizeof(float)*3;
-    constexpr uint32_t pixel_intensity_offset = sizeof(float)*3+sizeof(uint16_t);
-    uint32_t offset_reflectivity = 0, offset_time = 0;
-    for(size_t i=0; i<cloud_msg->fields.size(); ++i)
-    {
-        if ( cloud_msg->fields[i].name=="reflectivity" )
-            offset_reflectivity = cloud_msg->fields[i].offset;
-        if ( cloud_msg->fields[i].name=="t" )
-            offset_time = cloud_msg->fields[i].offset;
-    }
+  for (int c0 = 0; c0 < size.width; c0 += chunk_cols) {
+    const cv::Range curr{c0, c0 + chunk_cols};
 
-    //cv::Mat img = cv::Mat(cloud_msg->height, cloud_msg->width, CV_8UC1);
-    //ROS_INFO_STREAM( "size: h: " << cloud_msg->height << " w: " << cloud_msg->width << " np: " << num_points);
+    // 1. Eject columns to pano before the cloud overwrites them in sweep
+    engine_.PrepareScan(curr);
 
-    const uint32_t * const pixel_shift_by_row = cloud_msg->height == 128 ? &pixel_shift_by_row_os0_128[0] : &pixel_shift_by_row_os1_64[0];
-    const uint32_t add_offset = cloud_msg->height == 128 ? 33 : 15;
-    constexpr float max_dist = 127.f;
-    if ( pc_row_major_ )
-    {
-        tbb::parallel_for(
-            tbb::blocked_range<int>(0, num_points), [&](const auto& blk) {
-              for (int i = blk.begin(); i < blk.end(); ++i)
-        //for ( size_t i = 0; i < num_points; ++i )
-        {
-            // the cloud is row major and image should be too ( since step = width * sizeof(pt) )
-            // + pc is row major aka, first row of width, than second row of width etc...
-            const uint32_t row = i / cloud_msg->width; // this row should be correct
-            const uint32_t col = i - row * cloud_msg->width;
-            const uint32_t col_shifted = (col + cloud_msg->width - pixel_shift_by_row[row]+add_offset) % cloud_msg->width;
-            const uint32_t i_new = row * cloud_msg->width + col_shifted;
-
-            const uint32_t point_start = point_step * i_new;
-            const uint32_t pixel_start = pixel_step * i;
-
-            const Eigen::Vector3f p = Eigen::Map<const Eigen::Vector3f>(reinterpret_cast<const float*>(&cloud_msg->data[point_start]));
-            const float dist = p.norm();
-            const uint16_t scale_val = dist < max_dist;
-            Eigen::Map<Eigen::Vector3f>((float*)&image_msg->data[pixel_start]) = scale_val * p;
-            *reinterpret_cast<uint16_t*>(&image_msg->data[pixel_start + pixel_range_offset]) = scale_val * dist * range_scale;
-            *reinterpret_cast<uint16_t*>(&image_msg->data[pixel_start + pixel_intensity_offset]) = scale_val *
-                    *reinterpret_cast<const uint16_t*>(&cloud_msg->data[point_start + offset_reflectivity]);
-        //    img.at<uint8_t>(row,col) = std::max<int>(std::min<int>(255. * p.norm() / 25., 255),0);
-        }
-        });
-    }
-    else {
-        tbb::parallel_for(
-            tbb::blocked_range<int>(0, num_points), [&](const auto& blk) {
-              for (int i = blk.begin(); i < blk.end(); ++i)
-        //for ( size_t i = 0; i < num_points; ++i )
-        {
-//            // the cloud is col major
-//            const int row = i % cloud_msg->height;
-//            const int col = i / cloud_msg->height;
-//            const uint32_t i_new = col + row * cloud_msg->width;
-//            //const uint32_t i_new = row + col * cloud_msg->height;
-//            const uint32_t point_start = point_step * i;
-//            const uint32_t pixel_start = pixel_step * i_new;
-
-            // the cloud is col major and image should be row major ( step = width * sizeof(pt) )
-            // pc is col major aka, first col of height, than second col of height etc...
-            const uint32_t col = i / cloud_msg->height; // this col should be correct
-            const uint32_t row = i - col * cloud_msg->height;
-            const uint32_t col_shifted = (col + cloud_msg->width + pixel_shift_by_row[row]-add_offset) % cloud_msg->width;
-            const uint32_t i_new = col_shifted + row * cloud_msg->width;
-            //const uint32_t i_new = row + cloud_msg->height * col_shifted;
-            const uint32_t point_start = point_step * i;
-            const uint32_t pixel_start = pixel_step * i_new;
-
-            const Eigen::Vector3f p = Eigen::Map<const Eigen::Vector3f>(reinterpret_cast<const float*>(&cloud_msg->data[point_start]));
-            const float dist = p.norm();
-            const uint16_t scale_val = dist < max_dist;
-            Eigen::Map<Eigen::Vector3f>((float*)&image_msg->data[pixel_start]) = scale_val * p;
-            *reinterpret_cast<uint16_t*>(&image_msg->data[pixel_start + pixel_range_offset]) = scale_val * dist * range_scale;
-            *reinterpret_cast<uint16_t*>(&image_msg->data[pixel_start + pixel_intensity_offset]) = scale_val *
-                    *reinterpret_cast<const uint16_t*>(&cloud_msg->data[point_start + offset_reflectivity]);
-        //    img.at<uint8_t>(row,col) = std::max<int>(std::min<int>(255. * p.norm() / 25., 255),0);
-        }
-        });
-    }
-    if ( stamp_at_the_front_ )
+    // 2. Convert chunk directly into sweep storage, no copy needed later
+    LidarScan scan;
     {
-        int64_t new_stamp_offset = 0;
-        for ( int point_idx = num_points-1; point_idx >= 0 && new_stamp_offset == 0; --point_idx )
-        {
-            const uint32_t & t_ns = *reinterpret_cast<const uint32_t*>(&cloud_msg->data[cloud_msg->point_step * point_idx + offset_time]);
-            if ( t_ns <= 0 ) continue;
-            new_stamp_offset = t_ns;
-        }
-        image_msg->header.stamp += ros::Duration().fromNSec(new_stamp_offset);
-        cinfo_msg->header.stamp = image_msg->header.stamp;
+      auto _ = engine_.tm.Scoped("2.Sweep.Conv");
+      scan = MakeScan(
+          *cloud_msg, stamp, destagger_, engine_.sweep.mat, curr, tbb_);
     }
 
-    //cv::imwrite("./blub.png", img);
-    CameraCb(image_msg, cinfo_msg);
+    header.stamp = stamp - ros::Duration(scan.dt * (size.width - curr.end));
+    ProcessScan(scan, header);
+  }
 }
 
 void OdomNode::CameraCb(const sensor_msgs::ImageConstPtr& image_msg,
                         const sensor_msgs::CameraInfoConstPtr& cinfo_msg) {
-  static std_msgs::Header prev_header;
-  if (prev_header.seq > 0 && prev_header.seq + 1 != cinfo_msg->header.seq) {
-    ROS_ERROR_STREAM("Missing lidar data, prev: "
-                     << prev_header.seq << ", curr: " << cinfo_msg->header.seq);
-  }
-  prev_header = cinfo_msg->header;
-
-  if (lidar_frame_.empty()) {
-    lidar_frame_ = image_msg->header.frame_id;
-    // Allocate storage for sweep, grid and matcher
-    Initialize(*cinfo_msg);
-    ROS_INFO_STREAM("Lidar frame: " << lidar_frame_);
-    ROS_INFO_STREAM("Lidar initialized!");
-  }
-
-  if (!imuq_.full()) {
-//    ROS_WARN_STREAM(fmt::format(
-//        "Imu queue not full: {}/{}", imuq_.size(), imuq_.capacity()));
-    ROS_WARN_STREAM("Imu queue not full: " << imuq_.size() << " / " << imuq_.capacity());
-    return;
-  }
-
-  if (!tf_init_) {
-    ROS_WARN_STREAM("Transform not initialized");
-    return;
-  }
+  const cv::Size size(cinfo_msg->width, cinfo_msg->height);
+  if (!CheckLidar(cinfo_msg->header, size)) return;
 
   if (!scan_init_) {
     if (cinfo_msg->binning_x == 0) {
@@ -325,166 +284,101 @@ void OdomNode::CameraCb(const sensor_msgs::ImageConstPtr& image_msg,
     }
   }
 
-  // We can always process incoming scan no matter what
-  const auto scan = MakeScan(*image_msg, *cinfo_msg);
+  // Eject columns to pano before the image overwrites them in sweep
+  const cv::Range curr(cinfo_msg->roi.x_offset,
+                       cinfo_msg->roi.x_offset + cinfo_msg->roi.width);
+  engine_.PrepareScan(curr);
+
+  // Write image directly into sweep storage, no copy needed later
+  const auto scan = MakeScan(*image_msg, *cinfo_msg, engine_.sweep.mat);
+  ProcessScan(scan, cinfo_msg->header);
+}
+
+void OdomNode::ProcessScan(const LidarScan& scan,
+                           const std_msgs::Header& header) {
   ROS_DEBUG("Processing scan %d: [%d,%d)",
-            static_cast<int>(cinfo_msg->header.seq),
+            static_cast<int>(header.seq),
             scan.curr.start,
             scan.curr.end);
-  // Add scan to sweep, compute score and filter
-  Preprocess(scan);
+  // Engine calls OutputCb, which publishes with this header
+  header_ = header;
+  if (recorder_) {
+    std::scoped_lock lock{mtx_};
+    recorder_->Write(scan);
+  }
+  engine_.AddScan(scan);
 
-  Register();
+  if (vis_) Visualize(scan);
+}
 
-  PostProcess();
+void OdomNode::OutputCb(const OdomOutput& output) {
+  // Keep the completed pano until it is published
+  if (output.T_odom_pano_prev) T_odom_pano_ = output.T_odom_pano_prev;
 
   Logging();
-
-  Publish(cinfo_msg->header);
+  Publish(header_);
 }
 
-void OdomNode::Preprocess(const LidarScan& scan) {
-  // 1. Eject scan to pano, assuming traj is optimized
-  int n_added = 0;
-  {  // Note that at this point the new scan is not yet added to the sweep
-    auto _ = tm_.Scoped("1.Pano.Add");
-    n_added = pano_.Add(sweep_, scan.curr, tbb_);
-  }
-  sm_.GetRef("pano.add_points").Add(n_added);
-  ROS_DEBUG_STREAM("[pano.Add] num added: " << n_added);
-
-  // 2. Add current scan to sweep
-  int n_points = 0;
-  {  // Add scan to sweep
-    auto _ = tm_.Scoped("2.Sweep.Add");
-    n_points = sweep_.Add(scan);
-  }
-  sm_.GetRef("sweep.add").Add(n_points);
-  ROS_DEBUG_STREAM("[sweep.Add] num added: " << n_points);
-
-  // 3. Add current scan to grid
-  cv::Vec2i n_cells{};
-  {  // Reduce scan to grid and Filter
-    auto _ = tm_.Scoped("3.Grid.Add");
-    n_cells = grid_.Add(scan, tbb_);
-  }
-  ROS_DEBUG_STREAM("[grid.Add] Num valid cells: "
-                   << n_cells[0] << ", num good cells: " << n_cells[1]);
-
-  sm_.GetRef("grid.valid_cells").Add(n_cells[0]);
-  sm_.GetRef("grid.good_cells").Add(n_cells[1]);
-
-  // 4. Predict new scetion in trajectory
-  int n_imus{};
-  {  // Integarte imu to fill nominal traj
-    auto _ = tm_.Scoped("4.Imu.Integrate");
-    const int pred_cols = grid_.curr.size();
-    const auto t0 = grid_.TimeAt(grid_.cols() - pred_cols);
-    const auto dt = grid_.dt;
-
-    // Predict the segment of traj corresponding to current grid
-    n_imus = traj_.PredictNew(imuq_, t0, dt, pred_cols);
+void OdomNode::Visualize(const LidarScan& scan) {
+  // Drop this frame if the previous one is still being shown, imshow is slow
+  // and must not hold back the lidar thread
+  using namespace std::chrono_literals;
+  if (vis_done_.valid() &&
+      vis_done_.wait_for(0s) != std::future_status::ready) {
+    return;
   }
-  sm_.GetRef("traj.pred_imus").Add(n_imus);
-  ROS_DEBUG_STREAM("[traj.Predict] num imus: " << n_imus);
-
-  if (vis_) {
-    const auto& disps = grid_.DrawCurveVar();
 
+  const auto& grid = engine_.grid;
+  const auto& sweep = engine_.sweep;
+  const auto& pano = engine_.pano;
+
+  // Draw* and ExtractRange return buffers that are reused by the next call, so
+  // clone every image handed to pub_worker_
+  std::vector<cv::Mat> disps;
+  for (const auto& d : grid.DrawCurveVar()) disps.push_back(d.clone());
+  std::vector<cv::Mat> pano_disps;
+  for (const auto& d : pano.DrawRangeCount()) pano_disps.push_back(d.clone());
+
+  vis_done_ = pub_worker_.Submit([disps = std::move(disps),
+                                  pano_disps = std::move(pano_disps),
+                                  scan_range = scan.ExtractRange().clone(),
+                                  scan_scale = scan.scale,
+                                  filter = grid.DrawFilter().clone(),
+                                  max_curve = grid.max_curve,
+                                  match = grid.DrawMatch().clone(),
+                                  match_area = engine_.gicp.half_win.area(),
+                                  sweep_range = sweep.ExtractRange().clone(),
+                                  sweep_scale = sweep.scale,
+                                  max_cnt = pano.max_cnt]() {
     Imshow("scan",
-           ApplyCmap(scan.ExtractRange(),
-                     1.0 / scan.scale / kMaxRange,
+           ApplyCmap(scan_range,
+                     1.0 / scan_scale / kMaxRange,
                      cv::COLORMAP_PINK,
                      0));
     Imshow("curve", ApplyCmap(disps[0], 1 / 0.25, cv::COLORMAP_JET));
     Imshow("var", ApplyCmap(disps[1], 1 / 0.25, cv::COLORMAP_JET));
-    Imshow("filter",
-           ApplyCmap(
-               grid_.DrawFilter(), 1 / grid_.max_curve, cv::COLORMAP_JET));
-  }
-}
+    Imshow("filter", ApplyCmap(filter, 1 / max_curve, cv::COLORMAP_JET));
 
-void OdomNode::PostProcess() {
-  const auto num_good_cells = grid_.NumCandidates();
-  const auto num_matches = sm_.GetRef("grid.matches").last();
-  const double match_ratio = num_matches / num_good_cells;
-  ROS_DEBUG_STREAM("[pano.RenderCheck] match ratio: " << match_ratio);
-
-  auto T_p1_p2 = traj_.TfPanoLidar();
-  // Algin gravity means we will just set rotation to identity
-  if (pano_.align_gravity) T_p1_p2.so3() = Sophus::SO3d{};
-
-  // We use the inverse from now on
-  const auto T_p2_p1 = T_p1_p2.inverse();
-
-  int n_render = 0;
-  if (pano_.ShouldRender(T_p2_p1, match_ratio)) {
-//    ROS_WARN_STREAM(
-//        "=Render= " << fmt::format(
-//            "sweeps: {:2.3f}, trans: {:.3f}, match: {:.2f}% = {}/{}",
-//            pano_.num_sweeps,
-//            T_p1_p2.translation().norm(),
-//            match_ratio * 100,
-//            num_matches,
-//            num_good_cells));
-    ROS_WARN_STREAM("=Render= sweeps: " << pano_.num_sweeps
-                    << ", trans: " << T_p1_p2.translation().norm()
-                    << ", match: " << (match_ratio * 100)
-                    << " = " << num_matches << " / "<< num_good_cells );
-
-    // TODO (chao): need to think about how to run this in background without
-    // interfering with odom
-    auto _ = tm_.Scoped("Render");
-    // Render pano at the latest lidar pose wrt pano (T_p1_p2 = T_p1_lidar)
-    n_render = pano_.Render(T_p2_p1.cast<float>(), tbb_);
-    // Save current pano pose
-    T_odom_pano_ = traj_.T_odom_pano;
-    // Once rendering is done we need to update traj accordingly
-    traj_.MoveFrame(T_p2_p1);
-  }
-  if (n_render > 0) {
-    sm_.GetRef("pano.render_points").Add(n_render);
-    ROS_DEBUG_STREAM("[pano.Render] num render: " << n_render);
-  }
+    // display good match
+    Imshow("match",
+           ApplyCmap(match, 1.0 / (match_area * 4.0), cv::COLORMAP_JET));
 
-  // 7. Update sweep transforms for undistortion
-  {
-    auto _ = tm_.Scoped("7.Sweep.Interp");
-    sweep_.Interp(traj_, tbb_);
-  }
-
-  grid_.Interp(traj_);
-
-  if (vis_) {
     Imshow("sweep",
-           ApplyCmap(sweep_.ExtractRange(),
-                     1.0 / sweep_.scale / kMaxRange,
+           ApplyCmap(sweep_range,
+                     1.0 / sweep_scale / kMaxRange,
                      cv::COLORMAP_PINK,
                      0));
-    const auto& disps = pano_.DrawRangeCount();
-    Imshow(
-        "pano",
-        ApplyCmap(
-            disps[0], 1.0 / DepthPixel::kScale / kMaxRange, cv::COLORMAP_PINK));
-    Imshow("count",
-           ApplyCmap(disps[1], 1.0 / pano_.max_cnt, cv::COLORMAP_JET));
-  }
+    Imshow("pano",
+           ApplyCmap(pano_disps[0],
+                     1.0 / DepthPixel::kScale / kMaxRange,
+                     cv::COLORMAP_PINK));
+    Imshow("count", ApplyCmap(pano_disps[1], 1.0 / max_cnt, cv::COLORMAP_JET));
+  });
 }
 
 void OdomNode::Logging() {
-  // Record total time
-  TimerManager::StatsT stats;
-  absl::Duration time;
-  for (const auto& kv : tm_.dict()) {
-    if (absl::StartsWith(kv.first, "Total")) continue;
-    if (absl::StartsWith(kv.first, "Render")) continue;
-    time += kv.second.last();
-  }
-  stats.Add(time);
-  tm_.Update("Total", stats);
-
   if (log_ > 0) {
-    ROS_INFO_STREAM_THROTTLE(log_, tm_.ReportAll(true));
+    ROS_INFO_STREAM_THROTTLE(log_, engine_.tm.ReportAll(true));
   }
 }
 
@@ -1,19 +1,29 @@
 #pragma once
 
 #include <image_transport/image_transport.h>
+#include <ros/callback_queue.h>
 #include <ros/node_handle.h>
 #include <ros/subscriber.h>
 #include <sensor_msgs/PointCloud2.h>
 #include <tf2_ros/transform_listener.h>
 
+#include <future>
+#include <mutex>
+
+#include "sv/llol/engine.h"
+#include "sv/llol/record.h"
 #include "sv/node/conv.h"
-#include "sv/util/manager.h"
+#include "sv/util/worker.h"
 
 namespace sv {
 
 struct OdomNode {
   /// ros
+  ros::CallbackQueue imu_queue_;    // served by its own imu thread
+  ros::CallbackQueue lidar_queue_;  // lidar, camera and all processing
   ros::NodeHandle pnh_;
+  ros::NodeHandle imu_nh_;
+  ros::NodeHandle lidar_nh_;
   image_transport::ImageTransport it_;
   image_transport::CameraSubscriber sub_camera_;
   ros::Subscriber sub_imu_;
@@ -27,15 +37,16 @@ struct OdomNode {
   bool vis_{true};
   bool pc_row_major_{true};
   bool stamp_at_the_front_{false};
+  int num_chunks_{1};  // pose updates per full cloud, not lower latency
 
   bool rigid_{false};
   bool tf_overwrite_{false};
-  bool tf_init_{false};
   bool scan_init_{false};
   bool traj_updated_{false};
   double path_dist_{0.0};
 
   /// frames
+  std::mutex mtx_;  // imu_frame_ and recorder_ are shared by both queues
   std::string imu_frame_{};
   std::string lidar_frame_{};
   std::string pano_frame_{"pano"};
@@ -43,33 +54,38 @@ struct OdomNode {
   std::string odom_frame_{"odom"};
 
   /// odom
-  ImuQueue imuq_;
-  Trajectory traj_;
-  LidarSweep sweep_;
-  SweepGrid grid_;
-  DepthPano pano_;
-  GicpSolver gicp_;
-  std::optional<Sophus::SE3d> pano_pose_;
+  Destagger destagger_;
+  EngineParams params_;  // also written to the init record
+  OdomEngine engine_;
+  std_msgs::Header header_;  // header of the scan being processed
   std::optional<Sophus::SE3d> T_odom_pano_;
+  std::optional<RecordWriter> recorder_;  // record imus and scans for replay
 
-  /// stats
-  TimerManager tm_{"llol"};
-  StatsManager sm_{"llol"};
+  /// publish
+  std::future<void> vis_done_;  // last frame handed to imshow
+  // Sends messages and shows images off the lidar thread, last member so
+  // that pending jobs finish before anything they use is destroyed
+  Worker pub_worker_;
 
   /// Methods
   OdomNode(const ros::NodeHandle& pnh);
+  /// @brief Serve imu and lidar queues on separate threads until shutdown
+  void Spin();
   void ImuCb(const sensor_msgs::Imu& imu_msg);
   void LidarCb(const sensor_msgs::PointCloud2ConstPtr& lidar_msg);
   void CameraCb(const sensor_msgs::ImageConstPtr& image_msg,
                 const sensor_msgs::CameraInfoConstPtr& cinfo_msg);
+  /// @brief Fill messages from engine, pub_worker_ sends them
   void Publish(const std_msgs::Header& header);
   void Logging();
 
-  void Initialize(const sensor_msgs::CameraInfo& cinfo_msg);
-  void Preprocess(const LidarScan& scan);
-  void Register();
-  bool IcpRigid();
-  void PostProcess();
+  void Initialize(const cv::Size& sweep_size);
+  bool InitExtrinsics();
+  bool CheckLidar(const std_msgs::Header& header, const cv::Size& size);
+  void ProcessScan(const LidarScan& scan, const std_msgs::Header& header);
+  void OutputCb(const OdomOutput& output);
+  /// @brief Draw images from engine, pub_worker_ shows them
+  void Visualize(const LidarScan& scan);
 };
 
 }  // namespace sv
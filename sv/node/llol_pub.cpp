@@ -50,70 +50,77 @@ void OdomNode::Publish(const std_msgs::Header& header) {
 
   static auto pub_runtime = pnh_.advertise<sensor_msgs::Range>("runtime", 1);
 
+  // Only touched by pub_worker_
   static tf2_ros::TransformBroadcaster tf_broadcaster;
 
+  // Messages are filled from the engine here, since the next scan changes it,
+  // serializing and sending them is left to pub_worker_
+
   // Transform from pano to odom
   TransformStamped tf_o_p;
   tf_o_p.header.frame_id = odom_frame_;
   tf_o_p.header.stamp = header.stamp;
   tf_o_p.child_frame_id = pano_frame_;
-  SE3dToMsg(traj_.T_odom_pano, tf_o_p.transform);
-  tf_broadcaster.sendTransform(tf_o_p);
+  SE3dToMsg(engine_.traj.T_odom_pano, tf_o_p.transform);
+  pub_worker_.Submit([tf_o_p]() { tf_broadcaster.sendTransform(tf_o_p); });
 
   std_msgs::Header pano_header;
   pano_header.frame_id = pano_frame_;
   pano_header.stamp = header.stamp;
 
-  static MarkerArray grid_marray;
   if (pub_grid.getNumSubscribers() > 0) {
-    Grid2Markers(grid_, pano_header, grid_marray.markers);
-    pub_grid.publish(grid_marray);
+    MarkerArray grid_marray;
+    Grid2Markers(engine_.grid, pano_header, grid_marray.markers);
+    pub_worker_.Submit([m = std::move(grid_marray)]() { pub_grid.publish(m); });
   }
 
   // Publish as pose array
-  static PoseArray traj_parray;
   if (pub_traj.getNumSubscribers() > 0) {
+    PoseArray traj_parray;
     traj_parray.header = pano_header;
-    Traj2PoseArray(traj_, traj_parray);
-    pub_traj.publish(traj_parray);
+    Traj2PoseArray(engine_.traj, traj_parray);
+    pub_worker_.Submit([m = std::move(traj_parray)]() { pub_traj.publish(m); });
   }
 
   // publish undistorted sweep
-  static CloudXYZI sweep_cloud;
   if (pub_sweep.getNumSubscribers() > 0) {
-    Sweep2Cloud(sweep_, pano_header, sweep_cloud);
-    pub_sweep.publish(sweep_cloud);
+    CloudXYZI sweep_cloud;
+    engine_.sweep.InterpRange({0, engine_.sweep.cols()}, engine_.gsize);
+    Sweep2Cloud(engine_.sweep, pano_header, sweep_cloud);
+    pub_worker_.Submit(
+        [m = std::move(sweep_cloud)]() { pub_sweep.publish(m); });
   }
 
   // Publish pano
-  static CloudXYZ pano_cloud;
   if (pub_pano_cloud.getNumSubscribers() > 0) {
-    Pano2Cloud(pano_, pano_header, pano_cloud);
-    pub_pano_cloud.publish(pano_cloud);
+    CloudXYZ pano_cloud;
+    Pano2Cloud(engine_.pano, pano_header, pano_cloud);
+    pub_worker_.Submit(
+        [m = std::move(pano_cloud)]() { pub_pano_cloud.publish(m); });
   }
 
   // Publish match
-  static CloudXYZI feat_cloud;
   if (pub_feat.getNumSubscribers() > 0) {
-    Grid2Cloud(grid_, pano_header, feat_cloud);
-    pub_feat.publish(feat_cloud);
+    CloudXYZI feat_cloud;
+    Grid2Cloud(engine_.grid, pano_header, feat_cloud);
+    pub_worker_.Submit([m = std::move(feat_cloud)]() { pub_feat.publish(m); });
   }
 
   // publish imu bias
   if (pub_bias.getNumSubscribers() > 0) {
     sensor_msgs::Imu imu_bias;
     imu_bias.header.stamp = header.stamp;
-    tf2::toMsg(imuq_.bias.acc, imu_bias.linear_acceleration);
-    tf2::toMsg(imuq_.bias.gyr, imu_bias.angular_velocity);
-    pub_bias.publish(imu_bias);
+    tf2::toMsg(engine_.imuq.bias.acc, imu_bias.linear_acceleration);
+    tf2::toMsg(engine_.imuq.bias.gyr, imu_bias.angular_velocity);
+    pub_worker_.Submit([imu_bias]() { pub_bias.publish(imu_bias); });
   }
 
   //  static sensor_msgs::Imu imu_bias_std;
   //  if (pub_bias_std.getNumSubscribers() > 0) {
   //    imu_bias_std.header = imu_bias.header;
-  //    tf2::toMsg(imuq_.bias.acc_var.cwiseSqrt(),
+  //    tf2::toMsg(engine_.imuq.bias.acc_var.cwiseSqrt(),
   //               imu_bias_std.linear_acceleration);
-  //    tf2::toMsg(imuq_.bias.gyr_var.cwiseSqrt(),
+  //    tf2::toMsg(engine_.imuq.bias.gyr_var.cwiseSqrt(),
   //    imu_bias_std.angular_velocity); pub_bias_std.publish(imu_bias_std);
   //  }
 
@@ -121,26 +128,23 @@ void OdomNode::Publish(const std_msgs::Header& header) {
   if (pub_runtime.getNumSubscribers() > 0) {
     sensor_msgs::Range runtime;
     runtime.header = header;
-    const auto stat = tm_.GetStats("Total");
+    const auto stat = engine_.tm.GetStats("Total");
     runtime.field_of_view = absl::ToDoubleSeconds(stat.mean());
     runtime.min_range = absl::ToDoubleSeconds(stat.min());
     runtime.max_range = absl::ToDoubleSeconds(stat.max());
     runtime.range = absl::ToDoubleSeconds(stat.last());
-    pub_runtime.publish(runtime);
+    pub_worker_.Submit([runtime]() { pub_runtime.publish(runtime); });
   }
 
   // publish pano image/cinfo
-  static cv_bridge::CvImagePtr cv_ptr;
-  static sensor_msgs::CameraInfoPtr cinfo_msg = 
-    boost::make_shared<sensor_msgs::CameraInfo>();
-  static sensor_msgs::ImagePtr image_msg;
-  if (pub_pano_image.getNumSubscribers() > 0 || 
+  if (pub_pano_image.getNumSubscribers() > 0 ||
       pub_pano_viz_image.getNumSubscribers() > 0) {
     if (T_odom_pano_.has_value()) {
+      auto cinfo_msg = boost::make_shared<sensor_msgs::CameraInfo>();
       cinfo_msg->header.stamp = header.stamp;
       cinfo_msg->header.frame_id = completed_pano_frame_;
-      cinfo_msg->width = pano_.size().width;
-      cinfo_msg->height = pano_.size().height;
+      cinfo_msg->width = engine_.pano.size().width;
+      cinfo_msg->height = engine_.pano.size().height;
       Eigen::Map<RowMat34d> P_map(&cinfo_msg->P[0]);
       P_map = T_odom_pano_->matrix3x4();
       cinfo_msg->R[0] = DepthPixel::kScale;
@@ -152,23 +156,32 @@ void OdomNode::Publish(const std_msgs::Header& header) {
       tf_o_pi.header.stamp = header.stamp;
       tf_o_pi.child_frame_id = completed_pano_frame_;
       SE3dToMsg(*T_odom_pano_, tf_o_pi.transform);
-      tf_broadcaster.sendTransform(tf_o_pi);
 
-      if (pub_pano_image.getNumSubscribers() > 0) {
-        image_msg =
-            cv_bridge::CvImage(cinfo_msg->header, "16UC2", pano_.dbuf2).toImageMsg();
-        pub_pano_image.publish(image_msg, cinfo_msg);
-      }
-      if (pub_pano_viz_image.getNumSubscribers() > 0) {
-        // extract depth channel for rqt
-        cv::Mat channel[2];
-        cv::split(pano_.dbuf2, channel);
-        
-        image_msg =
-            cv_bridge::CvImage(cinfo_msg->header, "bgr8", 
-                ApplyCmap(channel[0], 1.0 / 65536, cv::COLORMAP_JET)).toImageMsg();
-        pub_pano_viz_image.publish(image_msg, cinfo_msg);
-      }
+      // dbuf2 is rewritten by the next render, so send a copy
+      const cv::Mat dbuf2 = engine_.pano.dbuf2.clone();
+      pub_worker_.Submit([tf_o_pi, cinfo_msg, dbuf2]() {
+        tf_broadcaster.sendTransform(tf_o_pi);
+
+        if (pub_pano_image.getNumSubscribers() > 0) {
+          const auto image_msg =
+              cv_bridge::CvImage(cinfo_msg->header, "16UC2", dbuf2)
+                  .toImageMsg();
+          pub_pano_image.publish(image_msg, cinfo_msg);
+        }
+        if (pub_pano_viz_image.getNumSubscribers() > 0) {
+          // extract depth channel for rqt
+          cv::Mat channel[2];
+          cv::split(dbuf2, channel);
+
+          const auto image_msg =
+              cv_bridge::CvImage(
+                  cinfo_msg->header,
+                  "bgr8",
+                  ApplyCmap(channel[0], 1.0 / 65536, cv::COLORMAP_JET))
+                  .toImageMsg();
+          pub_pano_viz_image.publish(image_msg, cinfo_msg);
+        }
+      });
 
       // clear so only publish once pano is done
       T_odom_pano_.reset();
@@ -179,10 +192,10 @@ void OdomNode::Publish(const std_msgs::Header& header) {
   PoseStamped pose;
   pose.header.stamp = header.stamp;
   pose.header.frame_id = odom_frame_;
-  SE3dToMsg(traj_.TfOdomLidar(), pose.pose);
-  pub_pose.publish(pose);
+  SE3dToMsg(engine_.traj.TfOdomLidar(), pose.pose);
+  pub_worker_.Submit([pose]() { pub_pose.publish(pose); });
 
-  {
+  pub_worker_.Submit([pose]() {
     // write to file:
     static std::ofstream posesFile ("./llol_after_map_poses.txt");
     if( posesFile.is_open() )
@@ -190,7 +203,7 @@ void OdomNode::Publish(const std_msgs::Header& header) {
       posesFile << (pose.header.stamp.toNSec()) << " " << pose.pose.position.x << " " << pose.pose.position.y << " " << pose.pose.position.z
                 << " " << pose.pose.orientation.x << " " << pose.pose.orientation.y << " " << pose.pose.orientation.z << " " << pose.pose.orientation.w <<std::endl;
     }
-  }
+  });
 
 
   if (pub_pose_cov.getNumSubscribers() > 0) {
@@ -199,30 +212,34 @@ void OdomNode::Publish(const std_msgs::Header& header) {
     pose_cov.pose.pose = pose.pose;
     Eigen::Map<RowMat6d> cov(&pose_cov.pose.covariance[0]);
     // transform covariance from local frame to odom frame
-    const auto R_odom_lidar = traj_.TfOdomLidar().so3().matrix();
+    const auto& traj = engine_.traj;
+    const auto R_odom_lidar = traj.TfOdomLidar().so3().matrix();
     cov.topLeftCorner<3, 3>().noalias() = R_odom_lidar *
-                                          traj_.cov.bottomRightCorner<3, 3>() *
+                                          traj.cov.bottomRightCorner<3, 3>() *
                                           R_odom_lidar.transpose();
     cov.bottomRightCorner<3, 3>().noalias() = R_odom_lidar *
-                                              traj_.cov.topLeftCorner<3, 3>() *
+                                              traj.cov.topLeftCorner<3, 3>() *
                                               R_odom_lidar.transpose();
-    pub_pose_cov.publish(pose_cov);
+    pub_worker_.Submit([pose_cov]() { pub_pose_cov.publish(pose_cov); });
   }
 
-  static Path path;
-  path.header = pose.header;
+  // path only lives on pub_worker_
+  pub_worker_.Submit([pose, path_dist = path_dist_]() {
+    static Path path;
+    path.header = pose.header;
 
-  if (path.poses.empty()) {
-    path.poses.push_back(pose);
-  } else {
-    Eigen::Map<const Vector3d> prev_p(&path.poses.back().pose.position.x);
-    Eigen::Map<const Vector3d> curr_p(&pose.pose.position.x);
-    if ((prev_p - curr_p).norm() > path_dist_) {
+    if (path.poses.empty()) {
       path.poses.push_back(pose);
+    } else {
+      Eigen::Map<const Vector3d> prev_p(&path.poses.back().pose.position.x);
+      Eigen::Map<const Vector3d> curr_p(&pose.pose.position.x);
+      if ((prev_p - curr_p).norm() > path_dist) {
+        path.poses.push_back(pose);
+      }
     }
-  }
 
-  pub_path.publish(path);
+    pub_path.publish(path);
+  });
 }
 
 }  // namespace sv
@@ -20,21 +20,31 @@ void Pano2Cloud(const DepthPano& pano,
   pcl_conversions::toPCL(header, cloud.header);
   tbb::parallel_for(tbb::blocked_range<int>(0, size.height),
                     [&](const auto& blk) {
+                      std::vector<float> rgs(size.width);
+                      std::vector<float> xs(size.width);
+                      std::vector<float> ys(size.width);
+                      std::vector<float> zs(size.width);
                       for (int r = blk.begin(); r < blk.end(); ++r) {
                         for (int c = 0; c < size.width; ++c) {
                           auto& pc = cloud.at(c, r);
-
-                          const auto rg = pano.RangeAt({c, r});
-                          if (rg == 0) {
-                            pc.x = pc.y = pc.z = kNaNF;
-                            continue;
-                          }
-
-                          const auto pp = pano.model.Backward(r, c, rg);
-                          pc.x = pp.x;
-                          pc.y = pp.y;
-                          pc.z = pp.z;
+                          pc.x = pc.y = pc.z = kNaNF;
+                          rgs[c] = pano.RangeAt({c, r});
                         }
+                        pano.model.BackwardRow(r,
+                                               0,
+                                               size.width,
+                                               rgs.data(),
+                                               xs.data(),
+                                               ys.data(),
+                                               zs.data());
+
+                        // Only pixels with depth are converted
+                        pano.mask.ForEachSet(r, 0, size.width, [&](int c) {
+                          auto& pc = cloud.at(c, r);
+                          pc.x = xs[c];
+                          pc.y = ys[c];
+                          pc.z = zs[c];
+                        });
                       }
                     });
 }
@@ -55,16 +65,16 @@ void Sweep2Cloud(const LidarSweep& sweep,
         for (int r = blk.begin(); r < blk.end(); ++r) {
           for (int c = 0; c < size.width; ++c) {
             auto& pt = cloud.at(c, r);
+            pt.x = pt.y = pt.z = pt.intensity = kNaNF;
+          }
 
+          // Only valid pixels are transformed
+          sweep.mask.ForEachSet(r, 0, size.width, [&](int c) {
+            auto& pt = cloud.at(c, r);
             const auto& pixel = sweep.PixelAt({c, r});
-            if (!pixel.Ok()) {
-              pt.x = pt.y = pt.z = pt.intensity = kNaNF;
-              continue;
-            }
-
             pt.getVector3fMap() = sweep.TfAt(c) * pixel.Vec3fMap();
             pt.intensity = pixel.intensity;
-          }
+          });
         }
       });
 }
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace sv {
+
+/// @brief Packed mask of an image, one bit per pixel, each row is padded to
+/// whole 64-bit words. Set bits could be visited without testing every pixel.
+class BitMask {
+ public:
+  using Word = uint64_t;
+  static constexpr int kBits = 64;
+
+  BitMask() = default;
+  BitMask(int rows, int cols)
+      : rows_{rows},
+        cols_{cols},
+        stride_{(cols + kBits - 1) / kBits},
+        words_(static_cast<size_t>(rows) * stride_, 0) {}
+
+  int rows() const noexcept { return rows_; }
+  int cols() const noexcept { return cols_; }
+  bool empty() const noexcept { return words_.empty(); }
+
+  const Word* RowPtr(int r) const { return words_.data() + r * stride_; }
+  Word* RowPtr(int r) { return words_.data() + r * stride_; }
+
+  bool Test(int r, int c) const {
+    return (RowPtr(r)[c / kBits] >> (c % kBits)) & 1;
+  }
+  void Set(int r, int c, bool v) {
+    auto& w = RowPtr(r)[c / kBits];
+    const int b = c % kBits;
+    // branchless, v is random for a sparse image
+    w = (w & ~(Word{1} << b)) | (Word{v} << b);
+  }
+  /// @brief Set a bit when other threads may set bits of the same word
+  void SetAtomic(int r, int c) {
+    __atomic_fetch_or(&RowPtr(r)[c / kBits],
+                      Word{1} << (c % kBits),
+                      __ATOMIC_RELAXED);
+  }
+  void Reset() { std::fill(words_.begin(), words_.end(), 0); }
+
+  /// @brief Number of set bits in row r
+  int CountRow(int r) const {
+    const auto* pw = RowPtr(r);
+    int n = 0;
+    for (int i = 0; i < stride_; ++i) n += __builtin_popcountll(pw[i]);
+    return n;
+  }
+  /// @brief Number of set bits
+  int Count() const {
+    int n = 0;
+    for (const auto w : words_) n += __builtin_popcountll(w);
+    return n;
+  }
+
+  /// @brief Call f(c) for every set bit c in [c0, c1) of row r, in order
+  template <typename F>
+  void ForEachSet(int r, int c0, int c1, F&& f) const {
+    if (c0 >= c1) return;
+    const auto* pw = RowPtr(r);
+    const int i0 = c0 / kBits;
+    const int i1 = (c1 - 1) / kBits;
+    for (int i = i0; i <= i1; ++i) {
+      Word w = pw[i];
+      // mask out bits outside of [c0, c1) in the first and last word
+      if (i == i0) w &= ~Word{0} << (c0 % kBits);
+      if (i == i1 && c1 % kBits != 0) w &= ~(~Word{0} << (c1 % kBits));
+      while (w) {
+        f(i * kBits + __builtin_ctzll(w));
+        w &= w - 1;  // clear lowest set bit
+      }
+    }
+  }
+
+  friend void swap(BitMask& lhs, BitMask& rhs) noexcept {
+    std::swap(lhs.rows_, rhs.rows_);
+    std::swap(lhs.cols_, rhs.cols_);
+    std::swap(lhs.stride_, rhs.stride_);
+    lhs.words_.swap(rhs.words_);
+  }
+
+ private:
+  int rows_{};
+  int cols_{};
+  int stride_{};  // words per row
+  std::vector<Word> words_;
+};
+
+}  // namespace sv
@@ -0,0 +1,60 @@
+#include "sv/util/bitmask.h"
+
+#include <gtest/gtest.h>
+
+namespace sv {
+namespace {
+
+TEST(BitMaskTest, TestDefault) {
+  BitMask mask;
+  EXPECT_TRUE(mask.empty());
+  EXPECT_EQ(mask.Count(), 0);
+}
+
+TEST(BitMaskTest, TestSetTest) {
+  BitMask mask(2, 130);
+  EXPECT_EQ(mask.rows(), 2);
+  EXPECT_EQ(mask.cols(), 130);
+
+  mask.Set(0, 0, true);
+  mask.Set(0, 63, true);
+  mask.Set(0, 64, true);
+  mask.Set(1, 129, true);
+  EXPECT_TRUE(mask.Test(0, 63));
+  EXPECT_TRUE(mask.Test(0, 64));
+  EXPECT_FALSE(mask.Test(1, 128));
+  EXPECT_EQ(mask.CountRow(0), 3);
+  EXPECT_EQ(mask.CountRow(1), 1);
+  EXPECT_EQ(mask.Count(), 4);
+
+  mask.Set(0, 63, false);
+  EXPECT_FALSE(mask.Test(0, 63));
+  mask.SetAtomic(1, 5);
+  EXPECT_TRUE(mask.Test(1, 5));
+  EXPECT_EQ(mask.Count(), 4);
+
+  mask.Reset();
+  EXPECT_EQ(mask.Count(), 0);
+}
+
+TEST(BitMaskTest, TestForEachSet) {
+  BitMask mask(1, 200);
+  const std::vector<int> cols{1, 62, 63, 64, 100, 127, 128, 199};
+  for (const auto c : cols) mask.Set(0, c, true);
+
+  std::vector<int> visited;
+  mask.ForEachSet(0, 0, 200, [&](int c) { visited.push_back(c); });
+  EXPECT_EQ(visited, cols);
+
+  // Partial range excludes bits outside of [c0, c1)
+  visited.clear();
+  mask.ForEachSet(0, 63, 128, [&](int c) { visited.push_back(c); });
+  EXPECT_EQ(visited, (std::vector<int>{63, 64, 100, 127}));
+
+  visited.clear();
+  mask.ForEachSet(0, 2, 62, [&](int c) { visited.push_back(c); });
+  EXPECT_TRUE(visited.empty());
+}
+
+}  // namespace
+}  // namespace sv
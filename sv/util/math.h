@@ -2,7 +2,9 @@
 
 #include <Eigen/Cholesky>
 #include <Eigen/Core>
+#include <algorithm>
 #include <cmath>
+#include <limits>
 #include <type_traits>
 
 namespace sv {
@@ -65,26 +67,36 @@ T AsinApprox(T x) {
   return x * (1 + x2 * (1 / 6.0 + x2 * (3.0 / 40.0 + x2 * 5.0 / 112.0)));
 }
 
-/// @brief A faster atan2
+/// @brief Polynomial approximation to atan for |x| <= 1, error < 1e-5 rad
+/// (Abramowitz and Stegun 4.4.49)
 template <typename T>
-T Atan2Approx(T y, T x) {
+inline T AtanApprox(T x) {
   static_assert(std::is_floating_point_v<T>, "T must be floating point");
-  // http://pubs.opengroup.org/onlinepubs/009695399/functions/atan2.html
-  // Volkan SALMA
-  static constexpr T kPi3_4 = M_PI_4 * 3;
-  static constexpr T kPi_4 = M_PI_4;
-
-  T r, angle;
-  T abs_y = fabs(y) + 1e-10;  // kludge to prevent 0/0 condition
-  if (x < 0.0) {
-    r = (x + abs_y) / (abs_y - x);
-    angle = kPi3_4;
-  } else {
-    r = (x - abs_y) / (x + abs_y);
-    angle = kPi_4;
-  }
-  angle += (0.1963 * r * r - 0.9817) * r;
-  return y < 0.0 ? -angle : angle;
+
+  const T x2 = x * x;
+  return x * (T(0.9998660) +
+              x2 * (T(-0.3302995) +
+                    x2 * (T(0.1801410) +
+                          x2 * (T(-0.0851330) + x2 * T(0.0208351)))));
+}
+
+/// @brief A faster atan2, error < 1e-5 rad. It is branchless so that loops
+/// calling it could be vectorized.
+template <typename T>
+inline T Atan2Approx(T y, T x) {
+  static_assert(std::is_floating_point_v<T>, "T must be floating point");
+  static constexpr T kPi = M_PI;
+  static constexpr T kPi_2 = M_PI_2;
+
+  const T abs_x = std::abs(x);
+  const T abs_y = std::abs(y);
+  // Reduce to atan of [0, 1], max is clamped to prevent 0/0
+  const T num = std::min(abs_x, abs_y);
+  const T den = std::max(std::max(abs_x, abs_y), std::numeric_limits<T>::min());
+  T angle = AtanApprox(num / den);
+  angle = abs_y > abs_x ? kPi_2 - angle : angle;
+  angle = x < 0 ? kPi - angle : angle;
+  return std::copysign(angle, y);
 }
 
 /// @struct Running mean and variance
@@ -81,6 +81,21 @@ TEST(MathTest, TestWrapCols) {
   EXPECT_EQ(WrapCols(63 - 2, 64), 61);
 }
 
+TEST(MathTest, TestAtan2Approx) {
+  // Sweep full circle, including axes and origin
+  for (int i = 0; i <= 3600; ++i) {
+    const double a = Deg2Rad(i / 10.0 - 180.0);
+    for (const double r : {1e-3, 1.0, 100.0}) {
+      const auto y = static_cast<float>(r * std::sin(a));
+      const auto x = static_cast<float>(r * std::cos(a));
+      EXPECT_NEAR(Atan2Approx(y, x), std::atan2(y, x), 2e-5);
+    }
+  }
+  EXPECT_EQ(Atan2Approx(0.0F, 0.0F), 0.0F);
+  EXPECT_NEAR(Atan2Approx(0.0F, -1.0F), kPiF, 2e-5);
+  EXPECT_NEAR(Atan2Approx(-0.0F, -1.0F), -kPiF, 2e-5);
+}
+
 void BM_Covariance(benchmark::State& state) {
   const auto X = Eigen::Matrix3Xd::Random(3, state.range(0)).eval();
 
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace sv {
+
+/// @brief A persistent thread that runs submitted jobs in order, so that a
+/// recurring background job does not create a new thread every time
+class Worker {
+ public:
+  Worker() : thread_{[this]() { Run(); }} {}
+  /// Jobs that are already submitted are run before the thread is joined
+  ~Worker() noexcept {
+    {
+      std::lock_guard lock{mtx_};
+      stop_ = true;
+    }
+    cv_.notify_one();
+    thread_.join();
+  }
+
+  Worker(const Worker&) = delete;
+  Worker& operator=(const Worker&) = delete;
+
+  /// @brief Queue job f
+  /// @return Future that is ready once f is done
+  template <typename F>
+  auto Submit(F&& f) -> std::future<decltype(f())> {
+    using R = decltype(f());
+    auto task = std::make_shared<std::packaged_task<R()>>(std::forward<F>(f));
+    auto future = task->get_future();
+    {
+      std::lock_guard lock{mtx_};
+      jobs_.emplace_back([task]() { (*task)(); });
+    }
+    cv_.notify_one();
+    return future;
+  }
+
+ private:
+  void Run() {
+    while (true) {
+      std::function<void()> job;
+      {
+        std::unique_lock lock{mtx_};
+        cv_.wait(lock, [this]() { return stop_ || !jobs_.empty(); });
+        if (jobs_.empty()) return;  // stopped and nothing left
+        job = std::move(jobs_.front());
+        jobs_.pop_front();
+      }
+      job();
+    }
+  }
+
+  std::mutex mtx_;
+  std::condition_variable cv_;
+  std::deque<std::function<void()>> jobs_;
+  bool stop_{false};
+  std::thread thread_;  // last member, so it starts after the others
+};
+
+}  // namespace sv
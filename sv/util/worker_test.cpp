@@ -0,0 +1,36 @@
+#include "sv/util/worker.h"
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+namespace sv {
+namespace {
+
+TEST(WorkerTest, TestSubmit) {
+  Worker worker;
+  auto f = worker.Submit([]() { return 42; });
+  EXPECT_EQ(f.get(), 42);
+}
+
+TEST(WorkerTest, TestOrder) {
+  // Jobs run on the same thread in the order they are submitted
+  std::vector<int> order;
+  std::thread::id id0;
+  std::thread::id id1;
+  {
+    Worker worker;
+    worker.Submit([&]() { id0 = std::this_thread::get_id(); });
+    for (int i = 0; i < 8; ++i) {
+      worker.Submit([&order, i]() { order.push_back(i); });
+    }
+    worker.Submit([&]() { id1 = std::this_thread::get_id(); });
+    // Pending jobs are run before worker is destroyed
+  }
+  EXPECT_EQ(order, (std::vector<int>{0, 1, 2, 3, 4, 5, 6, 7}));
+  EXPECT_EQ(id0, id1);
+  EXPECT_NE(id0, std::this_thread::get_id());
+}
+
+}  // namespace
+}  // namespace sv